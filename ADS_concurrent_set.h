@@ -0,0 +1,670 @@
+#ifndef ADS_CONCURRENT_SET_H
+#define ADS_CONCURRENT_SET_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ADS_set.h"
+
+// B+ tree for many threads, synchronized with optimistic lock coupling.
+// every node carries a version. readers never write to shared nodes, they
+// remember the version of each node on the way down and start over when one
+// of them changed. writers lock only the nodes they change: full nodes are
+// split and sparse ones merged on the way down, so a change never has to
+// climb back up. unlinked nodes are freed once no operation can see them anymore.
+// N, LeafN and InternalN pick the fanouts as in ADS_set
+template <typename Key, size_t N = 0, size_t LeafN = N, size_t InternalN = N>
+class ADS_concurrent_set {
+
+public:
+    using value_type = Key;
+    using key_type = Key;
+    using reference = key_type&;
+    using const_reference = const key_type&;
+    using size_type = size_t;
+    using key_compare = std::less<key_type>;
+
+    // readers copy and compare keys while a writer may change them
+    static_assert(std::is_trivially_copyable<key_type>::value, "ADS_concurrent_set needs trivially copyable keys");
+
+    // 2n keys / 2n keys and 2n+1 children, a node splits before it would overflow
+    static constexpr size_t leaf_n = LeafN ? LeafN : ADS_fanout<Key>::fit(ADS_LEAF_BYTES, ADS_fanout<Key>::header, sizeof(Key));
+    static constexpr size_t internal_n = InternalN ? InternalN : ADS_fanout<Key>::fit(ADS_INTERNAL_BYTES, ADS_fanout<Key>::header + sizeof(void*), sizeof(Key) + sizeof(void*));
+
+private:
+    using search = ADS_search<key_type, key_compare>;
+
+    class Node {
+
+    public:
+        // bit 0 obsolete, bit 1 locked, the rest counts the changes
+        std::atomic<uint64_t> version;
+        unsigned keys_counter;
+        bool leaf;
+    public:
+        explicit Node(bool _leaf);
+
+        uint64_t read_lock(bool& restart) const;
+        bool validate(uint64_t v) const;
+        bool upgrade(uint64_t& v);
+        void write_unlock();
+        void write_unlock_obsolete();
+    };
+
+    class alignas(ADS_fanout<Key>::cache_line) LeafNode : public Node {
+
+    public:
+        key_type keys[2*leaf_n];
+    public:
+        LeafNode();
+    };
+
+    class alignas(ADS_fanout<Key>::cache_line) InternalNode : public Node {
+
+    public:
+        key_type keys[2*internal_n];
+        Node* children[2*internal_n+1];
+    public:
+        InternalNode();
+    };
+
+    // every running operation publishes the epoch it started in.
+    // a retired node is freed when all published epochs are younger than it
+    struct Epoch_slot {
+        std::atomic<uint64_t> epoch; // 0 while free
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+    static constexpr size_t epoch_slots = 64;
+
+    class Epoch_guard {
+        const ADS_concurrent_set& set;
+        size_t slot;
+    public:
+        explicit Epoch_guard(const ADS_concurrent_set&);
+        ~Epoch_guard();
+    };
+
+    std::atomic<Node*> root;
+    std::atomic<size_type> element_counter;
+
+    mutable Epoch_slot active[epoch_slots];
+    mutable std::atomic<uint64_t> global_epoch;
+    std::mutex retired_mutex;
+    std::vector<std::pair<uint64_t, Node*>> retired;
+
+private:
+    bool try_insert(const_reference key, bool& inserted);
+    bool try_erase(const_reference key, bool& erased);
+    bool try_count(const_reference key, bool& found) const;
+
+    void split(InternalNode* parent, uint64_t parent_version, Node* node, uint64_t version);
+    bool merge(InternalNode* parent, uint64_t parent_version, unsigned index, Node* child, uint64_t child_version);
+    void collapse_root(InternalNode* old_root, uint64_t version);
+
+    static unsigned child_index(const InternalNode*, const_reference key);
+    static bool underfull(const Node*);
+    // least number of keys a node of the type is meant to hold
+    static size_t least(const Node*);
+
+    void retire(Node*);
+    static void destroy(Node*);
+
+public:
+    ADS_concurrent_set();
+    ADS_concurrent_set(const ADS_concurrent_set&) = delete;
+    ADS_concurrent_set& operator=(const ADS_concurrent_set&) = delete;
+    ~ADS_concurrent_set();
+
+    // exact when no writer runs, a snapshot otherwise
+    size_type size() const;
+    bool empty() const;
+
+    size_type count(const key_type& key) const;
+    bool insert(const key_type& key);
+    size_type erase(const key_type& key);
+};
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+constexpr size_t ADS_concurrent_set<Key,N,LeafN,InternalN>::leaf_n;
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+constexpr size_t ADS_concurrent_set<Key,N,LeafN,InternalN>::internal_n;
+
+// #pragma mark - Public ADS_concurrent_set methods
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+ADS_concurrent_set<Key,N,LeafN,InternalN>::ADS_concurrent_set() {
+    root.store(new LeafNode());
+    element_counter.store(0);
+    global_epoch.store(1);
+    for (size_t i = 0; i < epoch_slots; ++i) {
+        active[i].epoch.store(0);
+    }
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+ADS_concurrent_set<Key,N,LeafN,InternalN>::~ADS_concurrent_set() {
+    destroy(root.load());
+    for (auto& node : retired) {
+        destroy(node.second);
+    }
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+typename ADS_concurrent_set<Key,N,LeafN,InternalN>::size_type ADS_concurrent_set<Key,N,LeafN,InternalN>::size() const {
+    return element_counter.load(std::memory_order_relaxed);
+}
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+bool ADS_concurrent_set<Key,N,LeafN,InternalN>::empty() const {
+    return size() == 0;
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+typename ADS_concurrent_set<Key,N,LeafN,InternalN>::size_type ADS_concurrent_set<Key,N,LeafN,InternalN>::count(const key_type& key) const {
+    Epoch_guard guard(*this);
+    bool found = false;
+    while (!try_count(key, found)) {}
+    return found;
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+bool ADS_concurrent_set<Key,N,LeafN,InternalN>::insert(const key_type& key) {
+    Epoch_guard guard(*this);
+    bool inserted = false;
+    while (!try_insert(key, inserted)) {}
+    return inserted;
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+typename ADS_concurrent_set<Key,N,LeafN,InternalN>::size_type ADS_concurrent_set<Key,N,LeafN,InternalN>::erase(const key_type& key) {
+    Epoch_guard guard(*this);
+    bool erased = false;
+    while (!try_erase(key, erased)) {}
+    return erased;
+}
+
+// #pragma mark - Private ADS_concurrent_set methods
+
+// every try_ method returns false if it ran into a writer and has to start over
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+bool ADS_concurrent_set<Key,N,LeafN,InternalN>::try_count(const_reference key, bool& found) const {
+    bool restart = false;
+    Node *node = root.load();
+    uint64_t version = node->read_lock(restart);
+    if (restart || node != root.load()) {
+        return false;
+    }
+
+    InternalNode *parent = nullptr;
+    uint64_t parent_version = 0;
+
+    while (!node->leaf) {
+        InternalNode *internal = static_cast<InternalNode*>(node);
+
+        // a split of node that finished before we got its version shows in the parent
+        if (parent && !parent->validate(parent_version)) {
+            return false;
+        }
+        parent = internal;
+        parent_version = version;
+
+        // the child pointer is only worth something if nobody changed the node meanwhile
+        node = internal->children[child_index(internal, key)];
+        if (!internal->validate(version)) {
+            return false;
+        }
+        version = node->read_lock(restart);
+        if (restart) {
+            return false;
+        }
+    }
+
+    LeafNode *leaf = static_cast<LeafNode*>(node);
+    unsigned counter = leaf->keys_counter;
+    unsigned index = search::lower(leaf->keys, counter, key, key_compare());
+    found = index < counter && !key_compare()(key, leaf->keys[index]);
+
+    if (parent && !parent->validate(parent_version)) {
+        return false;
+    }
+    return leaf->validate(version);
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+bool ADS_concurrent_set<Key,N,LeafN,InternalN>::try_insert(const_reference key, bool& inserted) {
+    bool restart = false;
+    Node *node = root.load();
+    uint64_t version = node->read_lock(restart);
+    if (restart || node != root.load()) {
+        return false;
+    }
+
+    InternalNode *parent = nullptr;
+    uint64_t parent_version = 0;
+
+    while (!node->leaf) {
+        InternalNode *internal = static_cast<InternalNode*>(node);
+
+        // full nodes are split before we pass, so the parent always has room for a separator
+        if (internal->keys_counter == 2*internal_n) {
+            split(parent, parent_version, internal, version);
+            return false;
+        }
+        if (parent && !parent->validate(parent_version)) {
+            return false;
+        }
+
+        parent = internal;
+        parent_version = version;
+
+        node = internal->children[child_index(internal, key)];
+        if (!internal->validate(version)) {
+            return false;
+        }
+        version = node->read_lock(restart);
+        if (restart) {
+            return false;
+        }
+    }
+
+    LeafNode *leaf = static_cast<LeafNode*>(node);
+    if (leaf->keys_counter == 2*leaf_n) {
+        split(parent, parent_version, leaf, version);
+        return false;
+    }
+    if (!leaf->upgrade(version)) {
+        return false;
+    }
+    if (parent && !parent->validate(parent_version)) {
+        leaf->write_unlock();
+        return false;
+    }
+
+    unsigned index = search::lower(leaf->keys, leaf->keys_counter, key, key_compare());
+    inserted = index == leaf->keys_counter || key_compare()(key, leaf->keys[index]);
+    if (inserted) {
+        for (unsigned i = leaf->keys_counter; i > index; --i) {
+            leaf->keys[i] = leaf->keys[i-1];
+        }
+        leaf->keys[index] = key;
+        leaf->keys_counter += 1;
+        element_counter.fetch_add(1, std::memory_order_relaxed);
+    }
+    leaf->write_unlock();
+    return true;
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+bool ADS_concurrent_set<Key,N,LeafN,InternalN>::try_erase(const_reference key, bool& erased) {
+    bool restart = false;
+    Node *node = root.load();
+    uint64_t version = node->read_lock(restart);
+    if (restart || node != root.load()) {
+        return false;
+    }
+
+    InternalNode *parent = nullptr;
+    uint64_t parent_version = 0;
+
+    while (!node->leaf) {
+        InternalNode *internal = static_cast<InternalNode*>(node);
+
+        // a root with a single child hands its place over to the child
+        if (!parent && internal->keys_counter == 0) {
+            collapse_root(internal, version);
+            return false;
+        }
+        if (parent && !parent->validate(parent_version)) {
+            return false;
+        }
+
+        unsigned index = child_index(internal, key);
+        Node *child = internal->children[index];
+        if (!internal->validate(version)) {
+            return false;
+        }
+        uint64_t child_version = child->read_lock(restart);
+        if (restart) {
+            return false;
+        }
+
+        // sparse nodes are merged with a sibling before we pass
+        if (underfull(child) && merge(internal, version, index, child, child_version)) {
+            return false;
+        }
+
+        parent = internal;
+        parent_version = version;
+        node = child;
+        version = child_version;
+    }
+
+    LeafNode *leaf = static_cast<LeafNode*>(node);
+    if (!leaf->upgrade(version)) {
+        return false;
+    }
+    if (parent && !parent->validate(parent_version)) {
+        leaf->write_unlock();
+        return false;
+    }
+
+    unsigned index = search::lower(leaf->keys, leaf->keys_counter, key, key_compare());
+    erased = index < leaf->keys_counter && !key_compare()(key, leaf->keys[index]);
+    if (erased) {
+        for (unsigned i = index; i+1 < leaf->keys_counter; ++i) {
+            leaf->keys[i] = leaf->keys[i+1];
+        }
+        leaf->keys_counter -= 1;
+        element_counter.fetch_sub(1, std::memory_order_relaxed);
+    }
+    leaf->write_unlock();
+    return true;
+}
+
+// locks parent and node, moves the upper half of node into a new right sibling.
+// the caller starts over in any case
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+void ADS_concurrent_set<Key,N,LeafN,InternalN>::split(InternalNode* parent, uint64_t parent_version, Node* node, uint64_t version) {
+    if (parent && !parent->upgrade(parent_version)) {
+        return;
+    }
+    if (!node->upgrade(version)) {
+        if (parent) {
+            parent->write_unlock();
+        }
+        return;
+    }
+    // somebody else has grown the tree above the old root
+    if (!parent && node != root.load()) {
+        node->write_unlock();
+        return;
+    }
+
+    key_type separator;
+    Node *right_node;
+
+    if (node->leaf) {
+        LeafNode *left = static_cast<LeafNode*>(node);
+        LeafNode *right = new LeafNode();
+
+        // the left keeps the smaller half, its largest key separates them
+        unsigned half = left->keys_counter / 2;
+        for (unsigned i = half; i < left->keys_counter; ++i) {
+            right->keys[right->keys_counter++] = left->keys[i];
+        }
+        left->keys_counter = half;
+        separator = left->keys[half-1];
+        right_node = right;
+    } else {
+        InternalNode *left = static_cast<InternalNode*>(node);
+        InternalNode *right = new InternalNode();
+
+        // the middle key moves up
+        separator = left->keys[internal_n];
+        for (unsigned i = internal_n+1; i < left->keys_counter; ++i) {
+            right->keys[right->keys_counter++] = left->keys[i];
+        }
+        for (unsigned i = internal_n+1; i <= left->keys_counter; ++i) {
+            right->children[i-internal_n-1] = left->children[i];
+        }
+        left->keys_counter = internal_n;
+        right_node = right;
+    }
+
+    if (parent) {
+        unsigned index = search::lower(parent->keys, parent->keys_counter, separator, key_compare());
+        for (unsigned i = parent->keys_counter; i > index; --i) {
+            parent->keys[i] = parent->keys[i-1];
+            parent->children[i+1] = parent->children[i];
+        }
+        parent->keys[index] = separator;
+        parent->children[index+1] = right_node;
+        parent->keys_counter += 1;
+        parent->write_unlock();
+    } else {
+        InternalNode *new_root = new InternalNode();
+        new_root->keys[0] = separator;
+        new_root->children[0] = node;
+        new_root->children[1] = right_node;
+        new_root->keys_counter = 1;
+        root.store(new_root);
+    }
+    node->write_unlock();
+}
+
+// merges child with a neighbour if both fit into one node with room to spare.
+// returns false if they do not fit and nothing was touched, the caller goes on then
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+bool ADS_concurrent_set<Key,N,LeafN,InternalN>::merge(InternalNode* parent, uint64_t parent_version, unsigned index, Node* child, uint64_t child_version) {
+    if (parent->keys_counter == 0) {
+        return false;
+    }
+
+    unsigned left_index = index < parent->keys_counter ? index : index-1;
+    Node *sibling = parent->children[left_index == index ? index+1 : index-1];
+    if (!parent->validate(parent_version)) {
+        return true;
+    }
+    bool restart = false;
+    uint64_t sibling_version = sibling->read_lock(restart);
+    if (restart) {
+        return true;
+    }
+
+    Node *left = left_index == index ? child : sibling;
+    Node *right = left_index == index ? sibling : child;
+    uint64_t left_version = left_index == index ? child_version : sibling_version;
+    uint64_t right_version = left_index == index ? sibling_version : child_version;
+
+    // the counts are confirmed by the upgrades below
+    size_t common = left->keys_counter + right->keys_counter + (left->leaf ? 0 : 1);
+    if (common > least(left)) {
+        return false;
+    }
+
+    if (!parent->upgrade(parent_version)) {
+        return true;
+    }
+    if (!left->upgrade(left_version)) {
+        parent->write_unlock();
+        return true;
+    }
+    if (!right->upgrade(right_version)) {
+        left->write_unlock();
+        parent->write_unlock();
+        return true;
+    }
+
+    if (left->leaf) {
+        LeafNode *left_leaf = static_cast<LeafNode*>(left);
+        LeafNode *right_leaf = static_cast<LeafNode*>(right);
+        for (unsigned i = 0; i < right_leaf->keys_counter; ++i) {
+            left_leaf->keys[left_leaf->keys_counter++] = right_leaf->keys[i];
+        }
+    } else {
+        InternalNode *left_internal = static_cast<InternalNode*>(left);
+        InternalNode *right_internal = static_cast<InternalNode*>(right);
+
+        // the separator comes down between the two halves
+        left_internal->keys[left_internal->keys_counter++] = parent->keys[left_index];
+        for (unsigned i = 0; i <= right_internal->keys_counter; ++i) {
+            left_internal->children[left_internal->keys_counter+i] = right_internal->children[i];
+        }
+        for (unsigned i = 0; i < right_internal->keys_counter; ++i) {
+            left_internal->keys[left_internal->keys_counter++] = right_internal->keys[i];
+        }
+    }
+
+    // the right node leaves the parent
+    for (unsigned i = left_index; i+1 < parent->keys_counter; ++i) {
+        parent->keys[i] = parent->keys[i+1];
+        parent->children[i+1] = parent->children[i+2];
+    }
+    parent->keys_counter -= 1;
+
+    right->write_unlock_obsolete();
+    left->write_unlock();
+    parent->write_unlock();
+    retire(right);
+    return true;
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+void ADS_concurrent_set<Key,N,LeafN,InternalN>::collapse_root(InternalNode* old_root, uint64_t version) {
+    if (!old_root->upgrade(version)) {
+        return;
+    }
+    if (old_root != root.load()) {
+        old_root->write_unlock();
+        return;
+    }
+    root.store(old_root->children[0]);
+    old_root->write_unlock_obsolete();
+    retire(old_root);
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+unsigned ADS_concurrent_set<Key,N,LeafN,InternalN>::child_index(const InternalNode* internal, const_reference key) {
+    // a racing writer can change the counter, one read keeps the search inside the node
+    unsigned counter = internal->keys_counter;
+    return search::lower(internal->keys, counter, key, key_compare());
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+bool ADS_concurrent_set<Key,N,LeafN,InternalN>::underfull(const Node* current) {
+    return current->keys_counter * 4 < 2*least(current);
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+size_t ADS_concurrent_set<Key,N,LeafN,InternalN>::least(const Node* current) {
+    return current->leaf ? leaf_n : internal_n;
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+void ADS_concurrent_set<Key,N,LeafN,InternalN>::retire(Node* node) {
+    std::lock_guard<std::mutex> lock(retired_mutex);
+    retired.emplace_back(global_epoch.fetch_add(1), node);
+
+    uint64_t oldest = UINT64_MAX;
+    for (size_t i = 0; i < epoch_slots; ++i) {
+        uint64_t epoch = active[i].epoch.load();
+        if (epoch && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+
+    // whoever started before a node was retired may still hold it
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); ++i) {
+        if (retired[i].first < oldest) {
+            destroy(retired[i].second);
+        } else {
+            retired[kept++] = retired[i];
+        }
+    }
+    retired.resize(kept);
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+void ADS_concurrent_set<Key,N,LeafN,InternalN>::destroy(Node* current) {
+    if (current->leaf) {
+        delete static_cast<LeafNode*>(current);
+        return;
+    }
+    // retired nodes have given their children away, they are destroyed with their new parent
+    InternalNode *internal = static_cast<InternalNode*>(current);
+    if (!(internal->version.load() & 1)) {
+        for (unsigned i = 0; i <= internal->keys_counter; ++i) {
+            destroy(internal->children[i]);
+        }
+    }
+    delete internal;
+}
+
+// #pragma mark - Epoch_guard methods
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+ADS_concurrent_set<Key,N,LeafN,InternalN>::Epoch_guard::Epoch_guard(const ADS_concurrent_set& _set): set(_set) {
+    uint64_t epoch = set.global_epoch.load();
+    slot = std::hash<std::thread::id>()(std::this_thread::get_id()) % epoch_slots;
+
+    // more threads than slots wait for a free one
+    for (;;) {
+        uint64_t free = 0;
+        if (set.active[slot].epoch.compare_exchange_strong(free, epoch)) {
+            return;
+        }
+        slot = (slot + 1) % epoch_slots;
+        if (slot == 0) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+ADS_concurrent_set<Key,N,LeafN,InternalN>::Epoch_guard::~Epoch_guard() {
+    set.active[slot].epoch.store(0);
+}
+
+// #pragma mark - Node methods
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+ADS_concurrent_set<Key,N,LeafN,InternalN>::Node::Node(bool _leaf) {
+    version.store(0b100);
+    keys_counter = 0;
+    leaf = _leaf;
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+ADS_concurrent_set<Key,N,LeafN,InternalN>::LeafNode::LeafNode(): Node(true) {}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+ADS_concurrent_set<Key,N,LeafN,InternalN>::InternalNode::InternalNode(): Node(false) {}
+
+// waits until no writer holds the node
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+uint64_t ADS_concurrent_set<Key,N,LeafN,InternalN>::Node::read_lock(bool& restart) const {
+    uint64_t v = version.load(std::memory_order_acquire);
+    while (v & 0b10) {
+        std::this_thread::yield();
+        v = version.load(std::memory_order_acquire);
+    }
+    if (v & 1) {
+        restart = true;
+    }
+    return v;
+}
+
+// true if nobody wrote to the node since read_lock returned v
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+bool ADS_concurrent_set<Key,N,LeafN,InternalN>::Node::validate(uint64_t v) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version.load(std::memory_order_relaxed) == v;
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+bool ADS_concurrent_set<Key,N,LeafN,InternalN>::Node::upgrade(uint64_t& v) {
+    if (version.compare_exchange_strong(v, v + 0b10, std::memory_order_acquire)) {
+        v += 0b10;
+        return true;
+    }
+    return false;
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+void ADS_concurrent_set<Key,N,LeafN,InternalN>::Node::write_unlock() {
+    version.fetch_add(0b10, std::memory_order_release);
+}
+
+template <typename Key, size_t N, size_t LeafN, size_t InternalN>
+void ADS_concurrent_set<Key,N,LeafN,InternalN>::Node::write_unlock_obsolete() {
+    version.fetch_add(0b11, std::memory_order_release);
+}
+
+#endif // ADS_CONCURRENT_SET_H
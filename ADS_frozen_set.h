@@ -0,0 +1,321 @@
+#ifndef ADS_FROZEN_SET_H
+#define ADS_FROZEN_SET_H
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include "ADS_set.h"
+
+// immutable B+ tree without pointers, what ADS_set::freeze() returns.
+// every node is one cache line sized block of keys and the levels are stored
+// one after the other, root first, leafs last. the children of block k of a
+// level are the blocks k*(B+1) .. k*(B+1)+B of the level below, so a descent
+// only computes offsets. the leafs are the sorted keys cut into full blocks,
+// only the last one may be short. internal key j of block k is the smallest
+// key below child j+1, the keys of a block that has fewer children are unused
+template <typename Key, typename Compare = std::less<Key>, typename Allocator = std::allocator<Key>>
+class ADS_frozen_set {
+
+public:
+    class Iterator;
+    using value_type = Key;
+    using key_type = Key;
+    using reference = key_type&;
+    using const_reference = const key_type&;
+    using size_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using iterator = Iterator;
+    using const_iterator = Iterator;
+    using key_compare = Compare;
+    using allocator_type = Allocator;
+
+    // keys of a block, a block has one child more
+    static constexpr size_t block_keys = 2 * sizeof(Key) > ADS_fanout<Key>::cache_line ? 2 : ADS_fanout<Key>::cache_line / sizeof(Key);
+
+private:
+    using search = ADS_search<key_type, key_compare>;
+
+    struct alignas(ADS_fanout<Key>::cache_line) Block {
+        key_type keys[block_keys];
+    };
+    using block_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Block>;
+
+    // first block and number of blocks of one level
+    struct Level {
+        size_type offset;
+        size_type width;
+    };
+
+    // number of descents interleaved by count_many
+    static constexpr size_t batch_width = 16;
+
+    std::vector<Block, block_allocator> blocks;
+    std::vector<Level> levels; // root first, empty for an empty set
+    size_type element_counter;
+    key_compare compare;
+
+    const Block* leafs() const {
+        return blocks.data() + levels.back().offset;
+    }
+    // keys of block k that are in use, the children of a block on the level below
+    unsigned used_keys(size_t level, size_type k) const {
+        if (level + 1 == levels.size()) {
+            return (unsigned)std::min(size_type(block_keys), element_counter - k * block_keys);
+        }
+        return (unsigned)std::min(size_type(block_keys), levels[level+1].width - k * (block_keys+1) - 1);
+    }
+    size_type descend(size_t level, size_type k, const key_type& key) const;
+    size_type position_of(const key_type& key) const;
+    size_type position_after(const key_type& key) const;
+
+public:
+    explicit ADS_frozen_set(const Compare& comp = Compare(), const Allocator& alloc = Allocator());
+    // first to last have to be sorted by comp and free of duplicates, they are read twice
+    template<typename ForwardIt> ADS_frozen_set(ForwardIt first, ForwardIt last, const Compare& comp = Compare(), const Allocator& alloc = Allocator());
+
+    size_type size() const {
+        return element_counter;
+    }
+    bool empty() const {
+        return element_counter == 0;
+    }
+
+    size_type count(const key_type& key) const;
+    const_iterator find(const key_type& key) const;
+    size_type count_many(const key_type* keys, size_type n, std::vector<bool>& found) const;
+    const_iterator lower_bound(const key_type& key) const;
+    const_iterator upper_bound(const key_type& key) const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    allocator_type get_allocator() const;
+    key_compare key_comp() const;
+    void swap(ADS_frozen_set& other);
+};
+
+// bidirectional iterator, a position in the leafs
+template <typename Key, typename Compare, typename Allocator>
+class ADS_frozen_set<Key,Compare,Allocator>::Iterator {
+private:
+    const Block* leafs;
+    size_type index;
+public:
+    using value_type = Key;
+    using difference_type = std::ptrdiff_t;
+    using reference = const value_type&;
+    using pointer = const value_type*;
+    using iterator_category = std::bidirectional_iterator_tag;
+
+    Iterator() : leafs(nullptr), index(0) {}
+    explicit Iterator(const Block* _leafs, size_type _index) : leafs(_leafs), index(_index) {}
+    reference operator*() const {
+        return leafs[index / block_keys].keys[index % block_keys];
+    }
+    pointer operator->() const {
+        return &**this;
+    }
+    Iterator& operator++() {
+        ++index;
+        return *this;
+    }
+    Iterator operator++(int) {
+        Iterator it = *this;
+        ++*this;
+        return it;
+    }
+    Iterator& operator--() {
+        --index;
+        return *this;
+    }
+    Iterator operator--(int) {
+        Iterator it = *this;
+        --*this;
+        return it;
+    }
+
+    friend bool operator==(const Iterator& lhs, const Iterator& rhs) {
+        return lhs.index == rhs.index;
+    }
+    friend bool operator!=(const Iterator& lhs, const Iterator& rhs) {
+        return !(lhs==rhs);
+    }
+};
+
+template <typename Key, typename Compare, typename Allocator> void swap(ADS_frozen_set<Key,Compare,Allocator>& lhs, ADS_frozen_set<Key,Compare,Allocator>& rhs) { lhs.swap(rhs); }
+
+// #pragma mark - Public ADS_frozen_set methods
+
+template <typename Key, typename Compare, typename Allocator>
+ADS_frozen_set<Key,Compare,Allocator>::ADS_frozen_set(const Compare& comp, const Allocator& alloc) : blocks(block_allocator(alloc)), element_counter(0), compare(comp) {}
+
+template <typename Key, typename Compare, typename Allocator>
+template<typename ForwardIt> ADS_frozen_set<Key,Compare,Allocator>::ADS_frozen_set(ForwardIt first, ForwardIt last, const Compare& comp, const Allocator& alloc) : ADS_frozen_set(comp, alloc) {
+    element_counter = (size_type)std::distance(first, last);
+    if (!element_counter) {
+        return;
+    }
+
+    // widths bottom-up, every level above has a block per B+1 blocks below
+    std::vector<size_type> widths{ (element_counter + block_keys - 1) / block_keys };
+    while (widths.back() > 1) {
+        widths.push_back((widths.back() + block_keys) / (block_keys+1));
+    }
+    size_type total = 0;
+    for (auto it = widths.rbegin(); it != widths.rend(); ++it) {
+        levels.push_back(Level{total, *it});
+        total += *it;
+    }
+    blocks.resize(total);
+
+    Block* leaf = blocks.data() + levels.back().offset;
+    for (size_type i = 0; first != last; ++first, ++i) {
+        leaf[i / block_keys].keys[i % block_keys] = *first;
+    }
+
+    // the smallest key below child c of a level is the first key of its leftmost leaf
+    for (size_t level = 0; level + 1 < levels.size(); ++level) {
+        for (size_type k = 0; k < levels[level].width; ++k) {
+            Block& block = blocks[levels[level].offset + k];
+            unsigned used = used_keys(level, k);
+            for (unsigned j = 0; j < used; ++j) {
+                size_type c = k * (block_keys+1) + j + 1;
+                for (size_t below = level + 2; below < levels.size(); ++below) {
+                    c *= block_keys + 1;
+                }
+                block.keys[j] = leaf[c].keys[0];
+            }
+        }
+    }
+}
+
+template <typename Key, typename Compare, typename Allocator>
+typename ADS_frozen_set<Key,Compare,Allocator>::size_type ADS_frozen_set<Key,Compare,Allocator>::count(const key_type& key) const {
+    size_type position = position_of(key);
+    return position < element_counter && !compare(key, *Iterator(leafs(), position));
+}
+
+template <typename Key, typename Compare, typename Allocator>
+typename ADS_frozen_set<Key,Compare,Allocator>::const_iterator ADS_frozen_set<Key,Compare,Allocator>::find(const key_type& key) const {
+    size_type position = position_of(key);
+    if (position < element_counter && !compare(key, *Iterator(leafs(), position))) {
+        return Iterator(leafs(), position);
+    }
+    return end();
+}
+
+// all descents of a group have the same length, so the group steps down one level
+// at a time and the prefetches of one descent are in flight while the others search
+template <typename Key, typename Compare, typename Allocator>
+typename ADS_frozen_set<Key,Compare,Allocator>::size_type ADS_frozen_set<Key,Compare,Allocator>::count_many(const key_type* keys, size_type n, std::vector<bool>& found) const {
+    size_type hits = 0;
+    found.assign(n, false);
+    if (empty()) {
+        return hits;
+    }
+
+    size_type current[batch_width];
+    for (size_type first = 0; first < n; first += batch_width) {
+        size_type width = std::min(size_type(batch_width), n - first);
+        std::fill(current, current + width, size_type(0));
+
+        for (size_t level = 0; level + 1 < levels.size(); ++level) {
+            for (size_type j = 0; j < width; ++j) {
+                current[j] = descend(level, current[j], keys[first+j]);
+            }
+        }
+
+        const Block* leaf = leafs();
+        for (size_type j = 0; j < width; ++j) {
+            const key_type& key = keys[first+j];
+            size_type position = current[j] * block_keys + search::lower(leaf[current[j]].keys, used_keys(levels.size()-1, current[j]), key, compare);
+            if (position < element_counter && !compare(key, *Iterator(leaf, position))) {
+                found[first+j] = true;
+                ++hits;
+            }
+        }
+    }
+    return hits;
+}
+
+template <typename Key, typename Compare, typename Allocator>
+typename ADS_frozen_set<Key,Compare,Allocator>::const_iterator ADS_frozen_set<Key,Compare,Allocator>::lower_bound(const key_type& key) const {
+    return Iterator(empty() ? nullptr : leafs(), position_of(key));
+}
+
+template <typename Key, typename Compare, typename Allocator>
+typename ADS_frozen_set<Key,Compare,Allocator>::const_iterator ADS_frozen_set<Key,Compare,Allocator>::upper_bound(const key_type& key) const {
+    return Iterator(empty() ? nullptr : leafs(), position_after(key));
+}
+
+template <typename Key, typename Compare, typename Allocator>
+typename ADS_frozen_set<Key,Compare,Allocator>::const_iterator ADS_frozen_set<Key,Compare,Allocator>::begin() const {
+    return Iterator(empty() ? nullptr : leafs(), 0);
+}
+
+template <typename Key, typename Compare, typename Allocator>
+typename ADS_frozen_set<Key,Compare,Allocator>::const_iterator ADS_frozen_set<Key,Compare,Allocator>::end() const {
+    return Iterator(empty() ? nullptr : leafs(), element_counter);
+}
+
+template <typename Key, typename Compare, typename Allocator>
+typename ADS_frozen_set<Key,Compare,Allocator>::allocator_type ADS_frozen_set<Key,Compare,Allocator>::get_allocator() const {
+    return allocator_type(blocks.get_allocator());
+}
+
+template <typename Key, typename Compare, typename Allocator>
+typename ADS_frozen_set<Key,Compare,Allocator>::key_compare ADS_frozen_set<Key,Compare,Allocator>::key_comp() const {
+    return compare;
+}
+
+template <typename Key, typename Compare, typename Allocator>
+void ADS_frozen_set<Key,Compare,Allocator>::swap(ADS_frozen_set& other) {
+    using std::swap;
+    swap(blocks, other.blocks);
+    swap(levels, other.levels);
+    swap(element_counter, other.element_counter);
+    swap(compare, other.compare);
+}
+
+// #pragma mark - Private ADS_frozen_set methods
+
+// the child of block k to descend into, as a block of the level below.
+// its line is requested right away, nothing else is read before it is needed
+template <typename Key, typename Compare, typename Allocator>
+typename ADS_frozen_set<Key,Compare,Allocator>::size_type ADS_frozen_set<Key,Compare,Allocator>::descend(size_t level, size_type k, const key_type& key) const {
+    const Block& block = blocks[levels[level].offset + k];
+    size_type child = k * (block_keys+1) + search::upper(block.keys, used_keys(level, k), key, compare);
+    ADS_PREFETCH(&blocks[levels[level+1].offset + child]);
+    return child;
+}
+
+// number of keys less than key. the leaf reached holds every key equal to key
+// or, when all of its keys are less, is followed by the one that starts with it
+template <typename Key, typename Compare, typename Allocator>
+typename ADS_frozen_set<Key,Compare,Allocator>::size_type ADS_frozen_set<Key,Compare,Allocator>::position_of(const key_type& key) const {
+    if (empty()) {
+        return 0;
+    }
+    size_type k = 0;
+    for (size_t level = 0; level + 1 < levels.size(); ++level) {
+        k = descend(level, k, key);
+    }
+    return k * block_keys + search::lower(leafs()[k].keys, used_keys(levels.size()-1, k), key, compare);
+}
+
+template <typename Key, typename Compare, typename Allocator>
+typename ADS_frozen_set<Key,Compare,Allocator>::size_type ADS_frozen_set<Key,Compare,Allocator>::position_after(const key_type& key) const {
+    if (empty()) {
+        return 0;
+    }
+    size_type k = 0;
+    for (size_t level = 0; level + 1 < levels.size(); ++level) {
+        k = descend(level, k, key);
+    }
+    return k * block_keys + search::upper(leafs()[k].keys, used_keys(levels.size()-1, k), key, compare);
+}
+
+#endif // ADS_FROZEN_SET_H
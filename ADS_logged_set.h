@@ -0,0 +1,378 @@
+#ifndef ADS_LOGGED_SET_H
+#define ADS_LOGGED_SET_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ADS_set.h"
+
+// an ADS_set with a write-ahead log. insert and erase append a record of one
+// byte and the key to a buffer, commit() writes the buffer as one frame and
+// syncs it. committers arriving while a sync runs wait for the next one, so a
+// single fsync covers all of them (group commit). a frame carries its length
+// and a checksum, a torn frame at the end of the log is dropped on recovery.
+// checkpoint() saves the set next to the log and empties the log, opening the
+// set loads the checkpoint and replays the log on top of it. replaying a
+// record that is already in the checkpoint changes nothing.
+// keys have to be trivially copyable, the files are in the byte order of the machine
+template <typename Key, size_t N = 0, typename Allocator = std::allocator<Key>>
+class ADS_logged_set {
+
+public:
+    using set_type = ADS_set<Key,N,Allocator>;
+    using value_type = Key;
+    using key_type = Key;
+    using reference = key_type&;
+    using const_reference = const key_type&;
+    using size_type = size_t;
+    using key_compare = typename set_type::key_compare;
+    using allocator_type = Allocator;
+
+    static_assert(std::is_trivially_copyable<key_type>::value, "logged keys have to be trivially copyable");
+
+    static constexpr size_t default_group_bytes = 1 << 16;
+
+private:
+    struct Log_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t key_size;
+    };
+    struct Frame_header {
+        uint32_t length;
+        uint32_t checksum;
+    };
+    enum Record : char { insert_record = 'i', erase_record = 'e' };
+
+    static constexpr char log_magic[8] = {'A','D','S','_','w','a','l','\0'};
+    static constexpr uint32_t log_version = 1;
+    static constexpr size_t record_size = 1 + sizeof(key_type);
+
+    mutable std::mutex lock;
+    std::condition_variable synced;
+    set_type set;
+    std::string checkpoint_path;
+    std::string log_path;
+    int fd;
+    size_t group_bytes;
+
+    std::vector<char> pending;  // records not handed to a sync yet
+    uint64_t appended;          // records so far
+    uint64_t durable;           // records on disk
+    bool syncing;
+    bool broken;                // a sync failed, only a checkpoint repairs the log
+
+private:
+    static uint32_t checksum(const char* bytes, size_t n);
+    void append(Record type, const key_type& key);
+    void write_all(const char* bytes, size_t n);
+    void sync_group(std::unique_lock<std::mutex>& guard, uint64_t target);
+    void recover();
+    void reset_log();
+
+public:
+    // loads the checkpoint and replays the log, a commit is forced whenever group_bytes are pending
+    ADS_logged_set(const std::string& checkpoint_path, const std::string& log_path, size_t group_bytes = default_group_bytes, const Allocator& alloc = Allocator());
+    ADS_logged_set(const ADS_logged_set&) = delete;
+    ADS_logged_set& operator=(const ADS_logged_set&) = delete;
+    // commits what is pending
+    ~ADS_logged_set();
+
+    size_type size() const;
+    bool empty() const;
+    size_type count(const key_type& key) const;
+
+    bool insert(const key_type& key);
+    size_type erase(const key_type& key);
+
+    // returns when every change made before the call is on disk
+    void commit();
+    // saves the set and starts an empty log
+    void checkpoint();
+
+    // the set itself, only while no other thread changes it
+    const set_type& contents() const {
+        return set;
+    }
+};
+
+// #pragma mark - Public ADS_logged_set methods
+
+template <typename Key, size_t N, typename Allocator>
+ADS_logged_set<Key,N,Allocator>::ADS_logged_set(const std::string& _checkpoint_path, const std::string& _log_path, size_t _group_bytes, const Allocator& alloc) : set(alloc), checkpoint_path(_checkpoint_path), log_path(_log_path), fd(-1), group_bytes(_group_bytes), appended(0), durable(0), syncing(false), broken(false) {
+    std::ifstream checkpoint_file(checkpoint_path, std::ios::binary);
+    if (checkpoint_file) {
+        set.load(checkpoint_file);
+    }
+    recover();
+}
+
+template <typename Key, size_t N, typename Allocator>
+ADS_logged_set<Key,N,Allocator>::~ADS_logged_set() {
+    try {
+        commit();
+    } catch (...) {
+        // the records are lost like on a crash, the log stays consistent
+    }
+    ::close(fd);
+}
+
+template <typename Key, size_t N, typename Allocator>
+typename ADS_logged_set<Key,N,Allocator>::size_type ADS_logged_set<Key,N,Allocator>::size() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return set.size();
+}
+
+template <typename Key, size_t N, typename Allocator>
+bool ADS_logged_set<Key,N,Allocator>::empty() const {
+    return size() == 0;
+}
+
+template <typename Key, size_t N, typename Allocator>
+typename ADS_logged_set<Key,N,Allocator>::size_type ADS_logged_set<Key,N,Allocator>::count(const key_type& key) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return set.count(key);
+}
+
+template <typename Key, size_t N, typename Allocator>
+bool ADS_logged_set<Key,N,Allocator>::insert(const key_type& key) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (!set.insert(key).second) {
+        return false;
+    }
+    append(insert_record, key);
+    if (pending.size() >= group_bytes) {
+        sync_group(guard, appended);
+    }
+    return true;
+}
+
+template <typename Key, size_t N, typename Allocator>
+typename ADS_logged_set<Key,N,Allocator>::size_type ADS_logged_set<Key,N,Allocator>::erase(const key_type& key) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (!set.erase(key)) {
+        return 0;
+    }
+    append(erase_record, key);
+    if (pending.size() >= group_bytes) {
+        sync_group(guard, appended);
+    }
+    return 1;
+}
+
+template <typename Key, size_t N, typename Allocator>
+void ADS_logged_set<Key,N,Allocator>::commit() {
+    std::unique_lock<std::mutex> guard(lock);
+    sync_group(guard, appended);
+}
+
+template <typename Key, size_t N, typename Allocator>
+void ADS_logged_set<Key,N,Allocator>::checkpoint() {
+    std::unique_lock<std::mutex> guard(lock);
+    // the checkpoint covers the pending records, only a running sync has to finish
+    while (syncing) {
+        synced.wait(guard);
+    }
+
+    // the old checkpoint stays valid until the rename
+    std::string temporary = checkpoint_path + ".tmp";
+    {
+        std::ofstream o(temporary, std::ios::binary | std::ios::trunc);
+        set.save(o);
+        o.flush();
+        if (!o) {
+            throw runtime_error("write failed! checkpoint");
+        }
+    }
+    int checkpoint_fd = ::open(temporary.c_str(), O_RDONLY);
+    if (checkpoint_fd < 0 || ::fsync(checkpoint_fd) != 0) {
+        if (checkpoint_fd >= 0) {
+            ::close(checkpoint_fd);
+        }
+        throw runtime_error("sync failed! checkpoint");
+    }
+    ::close(checkpoint_fd);
+    if (std::rename(temporary.c_str(), checkpoint_path.c_str()) != 0) {
+        throw runtime_error("rename failed! checkpoint");
+    }
+    // the rename has to be on disk before the log is emptied, or a crash
+    // could find the old checkpoint next to an empty log
+    std::string::size_type slash = checkpoint_path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : checkpoint_path.substr(0, slash);
+    int directory_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (directory_fd < 0 || ::fsync(directory_fd) != 0) {
+        if (directory_fd >= 0) {
+            ::close(directory_fd);
+        }
+        throw runtime_error("directory sync failed! checkpoint");
+    }
+    ::close(directory_fd);
+    reset_log();
+    pending.clear();
+    durable = appended;
+    broken = false;
+}
+
+// #pragma mark - Private ADS_logged_set methods
+
+// FNV-1a
+template <typename Key, size_t N, typename Allocator>
+uint32_t ADS_logged_set<Key,N,Allocator>::checksum(const char* bytes, size_t n) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < n; ++i) {
+        hash = (hash ^ uint8_t(bytes[i])) * 16777619u;
+    }
+    return hash;
+}
+
+template <typename Key, size_t N, typename Allocator>
+void ADS_logged_set<Key,N,Allocator>::append(Record type, const key_type& key) {
+    size_t at = pending.size();
+    pending.resize(at + record_size);
+    pending[at] = type;
+    std::memcpy(pending.data() + at + 1, &key, sizeof(key_type));
+    ++appended;
+}
+
+template <typename Key, size_t N, typename Allocator>
+void ADS_logged_set<Key,N,Allocator>::write_all(const char* bytes, size_t n) {
+    while (n) {
+        ssize_t written = ::write(fd, bytes, n);
+        if (written <= 0) {
+            throw runtime_error("write failed! commit");
+        }
+        bytes += written;
+        n -= size_t(written);
+    }
+}
+
+// the first committer takes the pending records and syncs them without the
+// lock, the ones arriving meanwhile queue up behind it and go together next
+template <typename Key, size_t N, typename Allocator>
+void ADS_logged_set<Key,N,Allocator>::sync_group(std::unique_lock<std::mutex>& guard, uint64_t target) {
+    while (durable < target) {
+        if (broken) {
+            throw runtime_error("log is broken, checkpoint first! commit");
+        }
+        if (syncing) {
+            synced.wait(guard);
+            continue;
+        }
+        syncing = true;
+        std::vector<char> frame(sizeof(Frame_header));
+        frame.insert(frame.end(), pending.begin(), pending.end());
+        pending.clear();
+        uint64_t upto = appended;
+        guard.unlock();
+
+        Frame_header header;
+        header.length = uint32_t(frame.size() - sizeof(Frame_header));
+        header.checksum = checksum(frame.data() + sizeof(Frame_header), header.length);
+        std::memcpy(frame.data(), &header, sizeof(header));
+        bool failed = false;
+        try {
+            write_all(frame.data(), frame.size());
+            failed = ::fdatasync(fd) != 0;
+        } catch (...) {
+            failed = true;
+        }
+
+        guard.lock();
+        syncing = false;
+        if (!failed) {
+            durable = upto;
+        } else {
+            // a torn frame would hide every frame behind it
+            broken = true;
+        }
+        synced.notify_all();
+        if (failed) {
+            throw runtime_error("sync failed! commit");
+        }
+    }
+}
+
+// replays every complete frame and cuts the log behind the last one
+template <typename Key, size_t N, typename Allocator>
+void ADS_logged_set<Key,N,Allocator>::recover() {
+    std::vector<char> log;
+    {
+        std::ifstream i(log_path, std::ios::binary);
+        log.assign(std::istreambuf_iterator<char>(i), std::istreambuf_iterator<char>());
+    }
+    if (log.size() < sizeof(Log_header)) {
+        reset_log();
+        return;
+    }
+    Log_header header;
+    std::memcpy(&header, log.data(), sizeof(header));
+    if (std::memcmp(header.magic, log_magic, sizeof(header.magic)) != 0 || header.version != log_version || header.key_size != sizeof(key_type)) {
+        throw runtime_error("not a log of this set! ADS_logged_set");
+    }
+
+    size_t good = sizeof(Log_header);
+    while (log.size() - good >= sizeof(Frame_header)) {
+        Frame_header frame;
+        std::memcpy(&frame, log.data() + good, sizeof(frame));
+        const char* records = log.data() + good + sizeof(Frame_header);
+        if (frame.length % record_size != 0 || frame.length > log.size() - good - sizeof(Frame_header) || checksum(records, frame.length) != frame.checksum) {
+            break;
+        }
+        for (size_t at = 0; at < frame.length; at += record_size) {
+            key_type key;
+            std::memcpy(&key, records + at + 1, sizeof(key_type));
+            if (records[at] == insert_record) {
+                set.insert(key);
+            } else {
+                set.erase(key);
+            }
+        }
+        good += sizeof(Frame_header) + frame.length;
+    }
+
+    fd = ::open(log_path.c_str(), O_WRONLY);
+    if (fd < 0 || ::ftruncate(fd, off_t(good)) != 0 || ::lseek(fd, 0, SEEK_END) < 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw runtime_error("cannot open log! ADS_logged_set");
+    }
+}
+
+template <typename Key, size_t N, typename Allocator>
+void ADS_logged_set<Key,N,Allocator>::reset_log() {
+    if (fd < 0) {
+        fd = ::open(log_path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) {
+            throw runtime_error("cannot open log! ADS_logged_set");
+        }
+    }
+    Log_header header;
+    std::memcpy(header.magic, log_magic, sizeof(header.magic));
+    header.version = log_version;
+    header.key_size = sizeof(key_type);
+    if (::ftruncate(fd, 0) != 0 || ::lseek(fd, 0, SEEK_SET) < 0) {
+        throw runtime_error("truncate failed! reset_log");
+    }
+    write_all(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (::fsync(fd) != 0) {
+        throw runtime_error("sync failed! reset_log");
+    }
+}
+
+template <typename Key, size_t N, typename Allocator>
+constexpr char ADS_logged_set<Key,N,Allocator>::log_magic[8];
+
+#endif // ADS_LOGGED_SET_H
@@ -0,0 +1,932 @@
+#ifndef ADS_MAP_H
+#define ADS_MAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "ADS_set.h"
+
+// key/value B+ tree with the node layout of ADS_set: at most 2n keys a node, at
+// least n outside the root, leafs linked both ways, the in-node search of
+// ADS_search.h, the separators of ADS_separator and the slab pools of
+// ADS_node_pool. the values live in the leafs only, in an array next to the
+// keys, so descents never load them. keys and values have to be default
+// constructible. iterators yield pair<const Key&, T&> and are invalidated by
+// inserts and erases. N, LeafN and InternalN pick the fanouts as in ADS_set,
+// a derived leaf fanout counts the value next to each key
+template <typename Key, typename T, size_t N = 0, typename Allocator = std::allocator<std::pair<const Key, T>>, typename Compare = std::less<Key>, size_t LeafN = N, size_t InternalN = N>
+class ADS_map {
+
+public:
+    template <bool Const> class Iterator;
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<const key_type, mapped_type>;
+    using reference = std::pair<const key_type&, mapped_type&>;
+    using const_reference = std::pair<const key_type&, const mapped_type&>;
+    using size_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+    using key_compare = Compare;
+    using allocator_type = Allocator;
+
+    // 2n+1 keys and values, next and prev / 2n+1 keys and 2n+2 children
+    static constexpr size_t leaf_n = LeafN ? LeafN : ADS_fanout<Key>::fit(ADS_LEAF_BYTES, ADS_fanout<Key>::header + 2 * sizeof(void*) + sizeof(Key) + sizeof(T), sizeof(Key) + sizeof(T));
+    static constexpr size_t internal_n = InternalN ? InternalN : ADS_fanout<Key>::fit(ADS_INTERNAL_BYTES, ADS_fanout<Key>::header + sizeof(Key) + 2 * sizeof(void*), sizeof(Key) + sizeof(void*));
+
+private:
+    using search = ADS_search<key_type, key_compare>;
+    using separator = ADS_separator<key_type, key_compare>;
+
+    class InternalNode;
+
+    class Node {
+    public:
+        InternalNode* parent;
+        unsigned keys_counter;
+        bool leaf;
+
+        explicit Node(bool _leaf) : parent(nullptr), keys_counter(0), leaf(_leaf) {}
+    };
+
+    class alignas(ADS_fanout<Key>::cache_line) LeafNode : public Node {
+    public:
+        key_type keys[2*leaf_n+1];
+        mapped_type values[2*leaf_n+1];
+        LeafNode* next;
+        LeafNode* prev;
+
+        LeafNode() : Node(true), next(nullptr), prev(nullptr) {}
+    };
+
+    class alignas(ADS_fanout<Key>::cache_line) InternalNode : public Node {
+    public:
+        key_type keys[2*internal_n+1];
+        Node* children[2*internal_n+2];
+
+        InternalNode() : Node(false) {}
+    };
+
+    ADS_node_pool<LeafNode, Allocator> leaf_pool;
+    ADS_node_pool<InternalNode, Allocator> internal_pool;
+    Node* root;
+    size_type element_counter;
+    key_compare compare;
+
+private:
+    LeafNode* new_leaf();
+    InternalNode* new_internal();
+    void destroy(Node* current);
+    void destroy_all();
+
+    void move_assign(ADS_map& other, std::true_type);
+    void move_assign(ADS_map& other, std::false_type);
+    template <typename Propagate = typename std::allocator_traits<Allocator>::propagate_on_container_swap> void swap_trees(ADS_map& other, Propagate = Propagate());
+
+    // moved-from and cleared maps own no node, reads see a shared empty leaf
+    Node* top() const {
+        return root ? root : empty_leaf();
+    }
+    static LeafNode* empty_leaf();
+    void ensure_root();
+
+    LeafNode* find_leaf(const key_type& key) const;
+    static LeafNode* first_leaf(Node* current);
+    static LeafNode* last_leaf(Node* current);
+    static unsigned index_in_parent(const Node* current);
+    // least number of keys outside the root
+    static size_t least(const Node* current) {
+        return current->leaf ? leaf_n : internal_n;
+    }
+
+    template <typename K, typename... Args> std::pair<iterator,bool> emplace_key(K&& key, Args&&... args);
+    LeafNode* split_leaf(LeafNode* left);
+    void insert_in_parent(Node* left, key_type&& middle, Node* right);
+
+    void rebalance(Node* current);
+    void borrow_from_left(Node* current, unsigned index);
+    void borrow_from_right(Node* current, unsigned index);
+    void merge_nodes(InternalNode* parent, unsigned index);
+
+    Node* clone(const Node* source, InternalNode* parent, LeafNode*& last);
+
+public:
+    ADS_map() : ADS_map(Allocator()) {}
+    explicit ADS_map(const Allocator& alloc) : ADS_map(Compare(), alloc) {}
+    explicit ADS_map(const Compare& comp, const Allocator& alloc = Allocator());
+    ADS_map(std::initializer_list<value_type> ilist, const Allocator& alloc = Allocator());
+    ADS_map(std::initializer_list<value_type> ilist, const Compare& comp, const Allocator& alloc = Allocator());
+    template<typename InputIt> ADS_map(InputIt first, InputIt last, const Allocator& alloc = Allocator());
+    template<typename InputIt> ADS_map(InputIt first, InputIt last, const Compare& comp, const Allocator& alloc = Allocator());
+    ADS_map(const ADS_map& other);
+    // the moved-from map is left empty, it gets a root again when written to
+    ADS_map(ADS_map&& other) noexcept;
+    ~ADS_map();
+
+    ADS_map& operator=(const ADS_map& other);
+    // allocators that neither propagate nor compare equal get the pairs moved over one by one
+    ADS_map& operator=(ADS_map&& other) noexcept(std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value || std::allocator_traits<Allocator>::is_always_equal::value);
+    ADS_map& operator=(std::initializer_list<value_type> ilist);
+
+    size_type size() const {
+        return element_counter;
+    }
+    bool empty() const {
+        return element_counter == 0;
+    }
+    allocator_type get_allocator() const {
+        return leaf_pool.get_allocator();
+    }
+    key_compare key_comp() const {
+        return compare;
+    }
+
+    mapped_type& at(const key_type& key);
+    const mapped_type& at(const key_type& key) const;
+    mapped_type& operator[](const key_type& key);
+    mapped_type& operator[](key_type&& key);
+
+    // the value is only built when key is not there yet
+    template<typename... Args> std::pair<iterator,bool> try_emplace(const key_type& key, Args&&... args);
+    template<typename... Args> std::pair<iterator,bool> try_emplace(key_type&& key, Args&&... args);
+    template<typename M> std::pair<iterator,bool> insert_or_assign(const key_type& key, M&& obj);
+    template<typename M> std::pair<iterator,bool> insert_or_assign(key_type&& key, M&& obj);
+    std::pair<iterator,bool> insert(const value_type& value);
+    template<typename InputIt> void insert(InputIt first, InputIt last);
+    void insert(std::initializer_list<value_type> ilist);
+    template<typename... Args> std::pair<iterator,bool> emplace(Args&&... args);
+
+    size_type erase(const key_type& key);
+    iterator erase(const_iterator position);
+    void clear();
+    void swap(ADS_map& other);
+
+    size_type count(const key_type& key) const;
+    iterator find(const key_type& key);
+    const_iterator find(const key_type& key) const;
+    iterator lower_bound(const key_type& key);
+    const_iterator lower_bound(const key_type& key) const;
+    iterator upper_bound(const key_type& key);
+    const_iterator upper_bound(const key_type& key) const;
+
+    iterator begin();
+    iterator end();
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator cbegin() const {
+        return begin();
+    }
+    const_iterator cend() const {
+        return end();
+    }
+
+    // keys are compared by equivalence as in ADS_set, values with ==
+    friend bool operator==(const ADS_map& lhs, const ADS_map& rhs) {
+        if (lhs.element_counter != rhs.element_counter) {
+            return false;
+        }
+        for (const_iterator l = lhs.begin(), r = rhs.begin(); l != lhs.end(); ++l, ++r) {
+            if (lhs.compare((*l).first, (*r).first) || lhs.compare((*r).first, (*l).first) || !((*l).second == (*r).second)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    friend bool operator!=(const ADS_map& lhs, const ADS_map& rhs) {
+        return !(lhs == rhs);
+    }
+};
+
+// bidirectional, end() is one past the last key of the last leaf as in ADS_set
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <bool Const>
+class ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::Iterator {
+    friend class ADS_map;
+    template <bool> friend class ADS_map::Iterator;
+
+    LeafNode* current;
+    unsigned index;
+
+    explicit Iterator(LeafNode* _current, unsigned _index) : current(_current), index(_index) {}
+public:
+    using value_type = typename ADS_map::value_type;
+    using difference_type = std::ptrdiff_t;
+    using reference = typename std::conditional<Const, typename ADS_map::const_reference, typename ADS_map::reference>::type;
+    using iterator_category = std::bidirectional_iterator_tag;
+
+    // the pair of references is made on the fly, -> hands out a copy of it
+    class pointer {
+        reference pair;
+    public:
+        explicit pointer(reference _pair) : pair(_pair) {}
+        const reference* operator->() const {
+            return &pair;
+        }
+    };
+
+    Iterator() : current(nullptr), index(0) {}
+    template <bool Other, typename = typename std::enable_if<Const && !Other>::type>
+    Iterator(const Iterator<Other>& other) : current(other.current), index(other.index) {}
+
+    reference operator*() const {
+        return reference(current->keys[index], current->values[index]);
+    }
+    pointer operator->() const {
+        return pointer(**this);
+    }
+    Iterator& operator++() {
+        if (index + 1 < current->keys_counter || current->next == nullptr) {
+            ++index;
+        } else {
+            current = current->next;
+            index = 0;
+        }
+        return *this;
+    }
+    Iterator operator++(int) {
+        Iterator it = *this;
+        ++*this;
+        return it;
+    }
+    Iterator& operator--() {
+        if (index > 0) {
+            --index;
+        } else {
+            current = current->prev;
+            index = current->keys_counter - 1;
+        }
+        return *this;
+    }
+    Iterator operator--(int) {
+        Iterator it = *this;
+        --*this;
+        return it;
+    }
+
+    friend bool operator==(const Iterator& lhs, const Iterator& rhs) {
+        return lhs.current == rhs.current && lhs.index == rhs.index;
+    }
+    friend bool operator!=(const Iterator& lhs, const Iterator& rhs) {
+        return !(lhs == rhs);
+    }
+};
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void swap(ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>& lhs, ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>& rhs) { lhs.swap(rhs); }
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+constexpr size_t ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::leaf_n;
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+constexpr size_t ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::internal_n;
+
+// #pragma mark - Public ADS_map methods
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::ADS_map(const Compare& comp, const Allocator& alloc): leaf_pool(alloc), internal_pool(alloc), compare(comp) {
+    root = new_leaf();
+    element_counter = 0;
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::ADS_map(std::initializer_list<value_type> ilist, const Allocator& alloc): ADS_map(alloc) {
+    insert(ilist);
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::ADS_map(std::initializer_list<value_type> ilist, const Compare& comp, const Allocator& alloc): ADS_map(comp, alloc) {
+    insert(ilist);
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template<typename InputIt> ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::ADS_map(InputIt first, InputIt last, const Allocator& alloc): ADS_map(alloc) {
+    insert(first, last);
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template<typename InputIt> ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::ADS_map(InputIt first, InputIt last, const Compare& comp, const Allocator& alloc): ADS_map(comp, alloc) {
+    insert(first, last);
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::ADS_map(const ADS_map& other): leaf_pool(std::allocator_traits<Allocator>::select_on_container_copy_construction(other.get_allocator())), internal_pool(leaf_pool.get_allocator()), compare(other.compare) {
+    LeafNode *last = nullptr;
+    root = other.root ? clone(other.root, nullptr, last) : nullptr;
+    element_counter = other.element_counter;
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::ADS_map(ADS_map&& other) noexcept: leaf_pool(other.get_allocator()), internal_pool(other.get_allocator()), root(nullptr), element_counter(0), compare(other.compare) {
+    swap(other);
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::~ADS_map() {
+    destroy_all();
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>& ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::operator=(const ADS_map& other) {
+    if (this != &other) {
+        ADS_map copy(other);
+        swap(copy);
+    }
+    return *this;
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>& ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::operator=(ADS_map&& other) noexcept(std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value || std::allocator_traits<Allocator>::is_always_equal::value) {
+    if (this != &other) {
+        move_assign(other, typename std::allocator_traits<Allocator>::propagate_on_container_move_assignment());
+    }
+    return *this;
+}
+
+// the allocators go along with the slabs they handed out
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::move_assign(ADS_map& other, std::true_type) {
+    using std::swap;
+    clear();
+    swap_trees(other, std::true_type());
+    swap(compare, other.compare);
+}
+// our allocator stays. an equal one can free the slabs of other, otherwise the
+// pairs come over into our own pools
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::move_assign(ADS_map& other, std::false_type) {
+    if (get_allocator() == other.get_allocator()) {
+        clear();
+        swap(other);
+        return;
+    }
+    clear();
+    compare = other.compare;
+    for (LeafNode *leaf = first_leaf(other.top()); leaf; leaf = leaf->next) {
+        for (unsigned i = 0; i < leaf->keys_counter; ++i) {
+            emplace_key(std::move(leaf->keys[i]), std::move(leaf->values[i]));
+        }
+    }
+    other.clear();
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>& ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::operator=(std::initializer_list<value_type> ilist) {
+    clear();
+    insert(ilist);
+    return *this;
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+T& ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::at(const key_type& key) {
+    iterator it = find(key);
+    if (it == end()) {
+        throw out_of_range("key not found! at");
+    }
+    return it.current->values[it.index];
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+const T& ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::at(const key_type& key) const {
+    const_iterator it = find(key);
+    if (it == end()) {
+        throw out_of_range("key not found! at");
+    }
+    return it.current->values[it.index];
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+T& ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::operator[](const key_type& key) {
+    iterator it = emplace_key(key).first;
+    return it.current->values[it.index];
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+T& ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::operator[](key_type&& key) {
+    iterator it = emplace_key(std::move(key)).first;
+    return it.current->values[it.index];
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template<typename... Args> std::pair<typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::iterator,bool> ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::try_emplace(const key_type& key, Args&&... args) {
+    return emplace_key(key, std::forward<Args>(args)...);
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template<typename... Args> std::pair<typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::iterator,bool> ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::try_emplace(key_type&& key, Args&&... args) {
+    return emplace_key(std::move(key), std::forward<Args>(args)...);
+}
+
+// obj is only used once: to build the new value or to overwrite the old one
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template<typename M> std::pair<typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::iterator,bool> ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::insert_or_assign(const key_type& key, M&& obj) {
+    auto inserted = emplace_key(key, std::forward<M>(obj));
+    if (!inserted.second) {
+        inserted.first.current->values[inserted.first.index] = std::forward<M>(obj);
+    }
+    return inserted;
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template<typename M> std::pair<typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::iterator,bool> ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::insert_or_assign(key_type&& key, M&& obj) {
+    auto inserted = emplace_key(std::move(key), std::forward<M>(obj));
+    if (!inserted.second) {
+        inserted.first.current->values[inserted.first.index] = std::forward<M>(obj);
+    }
+    return inserted;
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+std::pair<typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::iterator,bool> ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::insert(const value_type& value) {
+    return emplace_key(value.first, value.second);
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template<typename InputIt> void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::insert(InputIt first, InputIt last) {
+    for (; first != last; ++first) {
+        emplace_key((*first).first, (*first).second);
+    }
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::insert(std::initializer_list<value_type> ilist) {
+    insert(ilist.begin(), ilist.end());
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template<typename... Args> std::pair<typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::iterator,bool> ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::emplace(Args&&... args) {
+    std::pair<key_type, mapped_type> value(std::forward<Args>(args)...);
+    return emplace_key(std::move(value.first), std::move(value.second));
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::size_type ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::erase(const key_type& key) {
+    LeafNode *leaf = find_leaf(key);
+    unsigned index = search::lower(leaf->keys, leaf->keys_counter, key, compare);
+    if (index == leaf->keys_counter || compare(key, leaf->keys[index])) {
+        return 0;
+    }
+
+    std::move(leaf->keys + index + 1, leaf->keys + leaf->keys_counter, leaf->keys + index);
+    std::move(leaf->values + index + 1, leaf->values + leaf->keys_counter, leaf->values + index);
+    leaf->keys_counter -= 1;
+    element_counter -= 1;
+
+    // separators above may still name the key, they stay valid bounds all the same
+    rebalance(leaf);
+    return 1;
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::iterator ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::erase(const_iterator position) {
+    key_type key = position.current->keys[position.index];
+    erase(key);
+    return lower_bound(key);
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::clear() {
+    destroy_all();
+    element_counter = 0;
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::swap(ADS_map& other) {
+    using std::swap;
+    swap_trees(other);
+    swap(compare, other.compare);
+}
+
+// the nodes and the pools they live in, the comparator stays
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <typename Propagate>
+void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::swap_trees(ADS_map& other, Propagate propagate) {
+    using std::swap;
+    swap(root, other.root);
+    swap(element_counter, other.element_counter);
+    leaf_pool.swap(other.leaf_pool, propagate);
+    internal_pool.swap(other.internal_pool, propagate);
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::size_type ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::count(const key_type& key) const {
+    return find(key) != end();
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::iterator ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::find(const key_type& key) {
+    iterator it = lower_bound(key);
+    if (it == end() || compare(key, it.current->keys[it.index])) {
+        return end();
+    }
+    return it;
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::const_iterator ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::find(const key_type& key) const {
+    return const_cast<ADS_map*>(this)->find(key);
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::iterator ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::lower_bound(const key_type& key) {
+    LeafNode *leaf = find_leaf(key);
+    unsigned index = search::lower(leaf->keys, leaf->keys_counter, key, compare);
+    if (index == leaf->keys_counter && leaf->next) {
+        return iterator(leaf->next, 0);
+    }
+    return iterator(leaf, index);
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::const_iterator ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::lower_bound(const key_type& key) const {
+    return const_cast<ADS_map*>(this)->lower_bound(key);
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::iterator ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::upper_bound(const key_type& key) {
+    LeafNode *leaf = find_leaf(key);
+    unsigned index = search::upper(leaf->keys, leaf->keys_counter, key, compare);
+    if (index == leaf->keys_counter && leaf->next) {
+        return iterator(leaf->next, 0);
+    }
+    return iterator(leaf, index);
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::const_iterator ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::upper_bound(const key_type& key) const {
+    return const_cast<ADS_map*>(this)->upper_bound(key);
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::iterator ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::begin() {
+    return iterator(first_leaf(top()), 0);
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::iterator ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::end() {
+    LeafNode *leaf = last_leaf(top());
+    return iterator(leaf, leaf->keys_counter);
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::const_iterator ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::begin() const {
+    return const_cast<ADS_map*>(this)->begin();
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::const_iterator ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::end() const {
+    return const_cast<ADS_map*>(this)->end();
+}
+
+// #pragma mark - Private ADS_map methods
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::LeafNode* ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::new_leaf() {
+    void *memory = leaf_pool.allocate();
+    try {
+        return new (memory) LeafNode();
+    } catch (...) {
+        leaf_pool.deallocate(memory);
+        throw;
+    }
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::InternalNode* ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::new_internal() {
+    void *memory = internal_pool.allocate();
+    try {
+        return new (memory) InternalNode();
+    } catch (...) {
+        internal_pool.deallocate(memory);
+        throw;
+    }
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::destroy(Node* current) {
+    if (!current) {
+        return;
+    }
+    if (current->leaf) {
+        LeafNode *leaf = static_cast<LeafNode*>(current);
+        leaf->~LeafNode();
+        leaf_pool.deallocate(leaf);
+    } else {
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        for (unsigned i = 0; i <= internal->keys_counter; ++i) {
+            destroy(internal->children[i]);
+        }
+        internal->~InternalNode();
+        internal_pool.deallocate(internal);
+    }
+}
+
+// pairs without destructors need no walk, the slabs go back as a whole
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::destroy_all() {
+    if (root && !(std::is_trivially_destructible<key_type>::value && std::is_trivially_destructible<mapped_type>::value)) {
+        destroy(root);
+    }
+    root = nullptr;
+    leaf_pool.release();
+    internal_pool.release();
+}
+
+// only ever read, every map of the type shares it
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::LeafNode* ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::empty_leaf() {
+    static LeafNode leaf;
+    return &leaf;
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::ensure_root() {
+    if (!root) {
+        root = new_leaf();
+    }
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::LeafNode* ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::find_leaf(const key_type& key) const {
+    Node *current = top();
+    while (!current->leaf) {
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        current = internal->children[search::upper(internal->keys, internal->keys_counter, key, compare)];
+    }
+    return static_cast<LeafNode*>(current);
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::LeafNode* ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::first_leaf(Node* current) {
+    while (!current->leaf) {
+        current = static_cast<InternalNode*>(current)->children[0];
+    }
+    return static_cast<LeafNode*>(current);
+}
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::LeafNode* ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::last_leaf(Node* current) {
+    while (!current->leaf) {
+        current = static_cast<InternalNode*>(current)->children[current->keys_counter];
+    }
+    return static_cast<LeafNode*>(current);
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+unsigned ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::index_in_parent(const Node* current) {
+    const InternalNode *parent = current->parent;
+    for (unsigned i = 0; i <= parent->keys_counter; ++i) {
+        if (parent->children[i] == current) {
+            return i;
+        }
+    }
+    throw runtime_error("no current in childrens from parent! index_in_parent");
+}
+
+// the value is built before anything moves, if that throws the map is unchanged
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <typename K, typename... Args>
+std::pair<typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::iterator,bool> ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::emplace_key(K&& key, Args&&... args) {
+    ensure_root();
+    LeafNode *leaf = find_leaf(key);
+    unsigned index = search::lower(leaf->keys, leaf->keys_counter, key, compare);
+    if (index < leaf->keys_counter && !compare(key, leaf->keys[index])) {
+        return {iterator(leaf, index), false};
+    }
+
+    mapped_type value(std::forward<Args>(args)...);
+    std::move_backward(leaf->keys + index, leaf->keys + leaf->keys_counter, leaf->keys + leaf->keys_counter + 1);
+    std::move_backward(leaf->values + index, leaf->values + leaf->keys_counter, leaf->values + leaf->keys_counter + 1);
+    leaf->keys[index] = std::forward<K>(key);
+    leaf->values[index] = std::move(value);
+    leaf->keys_counter += 1;
+    element_counter += 1;
+
+    if (leaf->keys_counter == 2*leaf_n+1) {
+        LeafNode *right = split_leaf(leaf);
+        if (index >= leaf_n) {
+            leaf = right;
+            index -= leaf_n;
+        }
+    }
+    return {iterator(leaf, index), true};
+}
+
+// the left leaf keeps leaf_n keys, the right one gets the other leaf_n+1
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::LeafNode* ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::split_leaf(LeafNode* left) {
+    LeafNode *right = new_leaf();
+    for (unsigned i = leaf_n; i < left->keys_counter; ++i) {
+        right->keys[right->keys_counter] = std::move(left->keys[i]);
+        right->values[right->keys_counter++] = std::move(left->values[i]);
+    }
+    left->keys_counter = leaf_n;
+
+    right->next = left->next;
+    right->prev = left;
+    if (left->next) {
+        left->next->prev = right;
+    }
+    left->next = right;
+
+    key_type middle = separator::shorten(left->keys[leaf_n-1], right->keys[0]);
+    insert_in_parent(left, std::move(middle), right);
+    return right;
+}
+
+// right goes in behind left, a full parent is split in turn and its middle key moves up
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::insert_in_parent(Node* left, key_type&& middle, Node* right) {
+    if (left == root) {
+        InternalNode *new_root = new_internal();
+        new_root->keys[0] = std::move(middle);
+        new_root->keys_counter = 1;
+        new_root->children[0] = left;
+        new_root->children[1] = right;
+        left->parent = new_root;
+        right->parent = new_root;
+        root = new_root;
+        return;
+    }
+
+    InternalNode *parent = left->parent;
+    unsigned index = index_in_parent(left);
+    std::move_backward(parent->keys + index, parent->keys + parent->keys_counter, parent->keys + parent->keys_counter + 1);
+    std::copy_backward(parent->children + index + 1, parent->children + parent->keys_counter + 1, parent->children + parent->keys_counter + 2);
+    parent->keys[index] = std::move(middle);
+    parent->children[index+1] = right;
+    parent->keys_counter += 1;
+    right->parent = parent;
+
+    if (parent->keys_counter == 2*internal_n+1) {
+        InternalNode *sibling = new_internal();
+        for (unsigned i = internal_n+1; i < parent->keys_counter; ++i) {
+            sibling->keys[sibling->keys_counter++] = std::move(parent->keys[i]);
+        }
+        for (unsigned i = internal_n+1; i <= parent->keys_counter; ++i) {
+            sibling->children[i-internal_n-1] = parent->children[i];
+            parent->children[i]->parent = sibling;
+        }
+        parent->keys_counter = internal_n;
+        insert_in_parent(parent, std::move(parent->keys[internal_n]), sibling);
+    }
+}
+
+// borrows from a sibling with keys to spare, otherwise merges with one and goes on
+// with the parent. an internal root left without keys hands over to its only child
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::rebalance(Node* current) {
+    while (current != root && current->keys_counter < least(current)) {
+        InternalNode *parent = current->parent;
+        unsigned index = index_in_parent(current);
+
+        if (index > 0 && parent->children[index-1]->keys_counter > least(current)) {
+            borrow_from_left(current, index);
+            return;
+        }
+        if (index < parent->keys_counter && parent->children[index+1]->keys_counter > least(current)) {
+            borrow_from_right(current, index);
+            return;
+        }
+        merge_nodes(parent, index > 0 ? index-1 : index);
+        current = parent;
+    }
+
+    if (!root->leaf && root->keys_counter == 0) {
+        InternalNode *old_root = static_cast<InternalNode*>(root);
+        root = old_root->children[0];
+        root->parent = nullptr;
+        old_root->~InternalNode();
+        internal_pool.deallocate(old_root);
+    }
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::borrow_from_left(Node* current, unsigned index) {
+    InternalNode *parent = current->parent;
+
+    if (current->leaf) {
+        LeafNode *leaf = static_cast<LeafNode*>(current);
+        LeafNode *left = static_cast<LeafNode*>(parent->children[index-1]);
+        std::move_backward(leaf->keys, leaf->keys + leaf->keys_counter, leaf->keys + leaf->keys_counter + 1);
+        std::move_backward(leaf->values, leaf->values + leaf->keys_counter, leaf->values + leaf->keys_counter + 1);
+        left->keys_counter -= 1;
+        leaf->keys[0] = std::move(left->keys[left->keys_counter]);
+        leaf->values[0] = std::move(left->values[left->keys_counter]);
+        leaf->keys_counter += 1;
+        parent->keys[index-1] = separator::shorten(left->keys[left->keys_counter-1], leaf->keys[0]);
+    } else {
+        // the last child of the left one comes over, the keys rotate through the parent
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        InternalNode *left = static_cast<InternalNode*>(parent->children[index-1]);
+        std::move_backward(internal->keys, internal->keys + internal->keys_counter, internal->keys + internal->keys_counter + 1);
+        std::copy_backward(internal->children, internal->children + internal->keys_counter + 1, internal->children + internal->keys_counter + 2);
+        internal->keys[0] = std::move(parent->keys[index-1]);
+        internal->children[0] = left->children[left->keys_counter];
+        internal->children[0]->parent = internal;
+        internal->keys_counter += 1;
+        left->keys_counter -= 1;
+        parent->keys[index-1] = std::move(left->keys[left->keys_counter]);
+    }
+}
+
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::borrow_from_right(Node* current, unsigned index) {
+    InternalNode *parent = current->parent;
+
+    if (current->leaf) {
+        LeafNode *leaf = static_cast<LeafNode*>(current);
+        LeafNode *right = static_cast<LeafNode*>(parent->children[index+1]);
+        leaf->keys[leaf->keys_counter] = std::move(right->keys[0]);
+        leaf->values[leaf->keys_counter] = std::move(right->values[0]);
+        leaf->keys_counter += 1;
+        std::move(right->keys + 1, right->keys + right->keys_counter, right->keys);
+        std::move(right->values + 1, right->values + right->keys_counter, right->values);
+        right->keys_counter -= 1;
+        parent->keys[index] = separator::shorten(leaf->keys[leaf->keys_counter-1], right->keys[0]);
+    } else {
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        InternalNode *right = static_cast<InternalNode*>(parent->children[index+1]);
+        internal->keys[internal->keys_counter] = std::move(parent->keys[index]);
+        internal->children[internal->keys_counter+1] = right->children[0];
+        right->children[0]->parent = internal;
+        internal->keys_counter += 1;
+        parent->keys[index] = std::move(right->keys[0]);
+        std::move(right->keys + 1, right->keys + right->keys_counter, right->keys);
+        std::copy(right->children + 1, right->children + right->keys_counter + 1, right->children);
+        right->keys_counter -= 1;
+    }
+}
+
+// children index and index+1 become one node, the key between them leaves the parent
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::merge_nodes(InternalNode* parent, unsigned index) {
+    Node *left = parent->children[index];
+    Node *right = parent->children[index+1];
+
+    if (left->leaf) {
+        LeafNode *left_leaf = static_cast<LeafNode*>(left);
+        LeafNode *right_leaf = static_cast<LeafNode*>(right);
+        for (unsigned i = 0; i < right_leaf->keys_counter; ++i) {
+            left_leaf->keys[left_leaf->keys_counter] = std::move(right_leaf->keys[i]);
+            left_leaf->values[left_leaf->keys_counter++] = std::move(right_leaf->values[i]);
+        }
+        left_leaf->next = right_leaf->next;
+        if (right_leaf->next) {
+            right_leaf->next->prev = left_leaf;
+        }
+        right_leaf->~LeafNode();
+        leaf_pool.deallocate(right_leaf);
+    } else {
+        InternalNode *left_internal = static_cast<InternalNode*>(left);
+        InternalNode *right_internal = static_cast<InternalNode*>(right);
+        left_internal->keys[left_internal->keys_counter++] = std::move(parent->keys[index]);
+        for (unsigned i = 0; i <= right_internal->keys_counter; ++i) {
+            left_internal->children[left_internal->keys_counter + i] = right_internal->children[i];
+            right_internal->children[i]->parent = left_internal;
+        }
+        for (unsigned i = 0; i < right_internal->keys_counter; ++i) {
+            left_internal->keys[left_internal->keys_counter++] = std::move(right_internal->keys[i]);
+        }
+        right_internal->~InternalNode();
+        internal_pool.deallocate(right_internal);
+    }
+
+    std::move(parent->keys + index + 1, parent->keys + parent->keys_counter, parent->keys + index);
+    std::copy(parent->children + index + 2, parent->children + parent->keys_counter + 1, parent->children + index + 1);
+    parent->keys_counter -= 1;
+}
+
+// depth first, so the leafs come in key order and are linked on the way.
+// what is built of a subtree is freed again if a copy throws
+template <typename Key, typename T, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::Node* ADS_map<Key,T,N,Allocator,Compare,LeafN,InternalN>::clone(const Node* source, InternalNode* parent, LeafNode*& last) {
+    if (source->leaf) {
+        const LeafNode *from = static_cast<const LeafNode*>(source);
+        LeafNode *leaf = new_leaf();
+        try {
+            std::copy(from->keys, from->keys + from->keys_counter, leaf->keys);
+            std::copy(from->values, from->values + from->keys_counter, leaf->values);
+        } catch (...) {
+            destroy(leaf);
+            throw;
+        }
+        leaf->keys_counter = from->keys_counter;
+        leaf->parent = parent;
+        leaf->prev = last;
+        if (last) {
+            last->next = leaf;
+        }
+        last = leaf;
+        return leaf;
+    }
+
+    const InternalNode *from = static_cast<const InternalNode*>(source);
+    InternalNode *internal = new_internal();
+    internal->parent = parent;
+    unsigned made = 0;
+    try {
+        std::copy(from->keys, from->keys + from->keys_counter, internal->keys);
+        for (; made <= from->keys_counter; ++made) {
+            internal->children[made] = clone(from->children[made], internal, last);
+        }
+    } catch (...) {
+        for (unsigned i = 0; i < made; ++i) {
+            destroy(internal->children[i]);
+        }
+        internal->~InternalNode();
+        internal_pool.deallocate(internal);
+        throw;
+    }
+    internal->keys_counter = from->keys_counter;
+    return internal;
+}
+
+#endif // ADS_MAP_H
@@ -0,0 +1,402 @@
+#ifndef ADS_MAPPED_SET_H
+#define ADS_MAPPED_SET_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ADS_set.h"
+
+// read-only B+ tree that lives in a file and is queried where it is mapped.
+// nodes point to each other by byte offsets from the start of the file, so
+// opening it parses nothing and allocates nothing, and every process mapping
+// the same file shares its pages. write() lays the keys of an ADS_set out as
+// full leafs followed by the internal levels, bottom-up, the root comes last.
+// keys have to be trivially copyable, the file is in the byte order of the machine
+template <typename Key, size_t N = 32>
+class ADS_mapped_set {
+
+public:
+    class Iterator;
+    using value_type = Key;
+    using key_type = Key;
+    using reference = key_type&;
+    using const_reference = const key_type&;
+    using size_type = size_t;
+    using iterator = Iterator;
+    using const_iterator = Iterator;
+    using key_compare = std::less<key_type>;
+
+    static_assert(std::is_trivially_copyable<key_type>::value, "mapped keys have to be trivially copyable");
+
+private:
+    using search = ADS_search<key_type, key_compare>;
+
+    struct File_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t key_size;
+        uint64_t node_keys;
+        uint64_t count;
+        uint64_t bytes;
+        uint64_t root;  // 0 when empty
+        uint64_t first_leaf;
+    };
+
+    // followed by the keys, internal nodes also by the child offsets
+    struct Node_header {
+        uint32_t keys_counter;
+        uint32_t leaf;
+        uint64_t next; // next leaf, 0 at the end
+    };
+
+    static constexpr char file_magic[8] = {'A','D','S','_','m','a','p','\0'};
+    static constexpr uint32_t file_version = 1;
+    static constexpr size_t max_keys = 2*N;
+    static constexpr size_t node_align = alignof(key_type) > alignof(uint64_t) ? alignof(key_type) : alignof(uint64_t);
+
+    static constexpr size_t align(size_t bytes) {
+        return (bytes + node_align - 1) / node_align * node_align;
+    }
+    static constexpr size_t keys_offset = align(sizeof(Node_header));
+    static constexpr size_t leaf_size = align(keys_offset + max_keys * sizeof(key_type));
+    static constexpr size_t children_offset = leaf_size;
+    static constexpr size_t internal_size = align(children_offset + (max_keys+1) * sizeof(uint64_t));
+    static constexpr size_t header_size = align(sizeof(File_header));
+
+    const char* base;
+    size_t bytes;
+    const File_header* header;
+
+    const Node_header* node(uint64_t offset) const {
+        return reinterpret_cast<const Node_header*>(base + offset);
+    }
+    static const key_type* keys_of(const Node_header* node) {
+        return reinterpret_cast<const key_type*>(reinterpret_cast<const char*>(node) + keys_offset);
+    }
+    static const uint64_t* children_of(const Node_header* node) {
+        return reinterpret_cast<const uint64_t*>(reinterpret_cast<const char*>(node) + children_offset);
+    }
+    uint64_t find_leaf(const key_type& key) const;
+
+    // one level while writing: the offset of every node and the smallest key below it
+    struct Level_entry {
+        uint64_t offset;
+        key_type first;
+    };
+    static void write_padding(std::ofstream& o, size_t n);
+
+public:
+    // maps the file read-only, throws if it was not written by write()
+    explicit ADS_mapped_set(const std::string& path);
+    ADS_mapped_set(const ADS_mapped_set&) = delete;
+    ADS_mapped_set& operator=(const ADS_mapped_set&) = delete;
+    ADS_mapped_set(ADS_mapped_set&& other);
+    ADS_mapped_set& operator=(ADS_mapped_set&& other);
+    ~ADS_mapped_set();
+
+    template <size_t M, typename Allocator, size_t LeafM, size_t InternalM>
+    static void write(const ADS_set<Key,M,Allocator,std::less<Key>,LeafM,InternalM>& set, const std::string& path);
+
+    // a moved-from set maps nothing and reads as empty
+    size_type size() const {
+        return header ? header->count : 0;
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+    size_type count(const key_type& key) const;
+    const_iterator find(const key_type& key) const;
+    const_iterator lower_bound(const key_type& key) const;
+    const_iterator upper_bound(const key_type& key) const;
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    void swap(ADS_mapped_set& other);
+};
+
+// forward iterator, the leafs are chained by offsets
+template <typename Key, size_t N>
+class ADS_mapped_set<Key,N>::Iterator {
+private:
+    const char* base;
+    uint64_t current; // 0 is end()
+    size_t index;
+
+    const Node_header* leaf() const {
+        return reinterpret_cast<const Node_header*>(base + current);
+    }
+public:
+    using value_type = Key;
+    using difference_type = std::ptrdiff_t;
+    using reference = const value_type&;
+    using pointer = const value_type*;
+    using iterator_category = std::forward_iterator_tag;
+
+    Iterator() : base(nullptr), current(0), index(0) {}
+    explicit Iterator(const char* _base, uint64_t _current, size_t _index) : base(_base), current(_current), index(_index) {
+        if (current && index == leaf()->keys_counter) {
+            current = leaf()->next;
+            index = 0;
+        }
+    }
+    reference operator*() const {
+        return keys_of(leaf())[index];
+    }
+    pointer operator->() const {
+        return &keys_of(leaf())[index];
+    }
+    Iterator& operator++() {
+        if (++index == leaf()->keys_counter) {
+            current = leaf()->next;
+            index = 0;
+        }
+        return *this;
+    }
+    Iterator operator++(int) {
+        Iterator it = *this;
+        ++*this;
+        return it;
+    }
+
+    friend bool operator==(const Iterator& lhs, const Iterator& rhs) {
+        return lhs.current == rhs.current && lhs.index == rhs.index;
+    }
+    friend bool operator!=(const Iterator& lhs, const Iterator& rhs) {
+        return !(lhs==rhs);
+    }
+};
+
+template <typename Key, size_t N> void swap(ADS_mapped_set<Key,N>& lhs, ADS_mapped_set<Key,N>& rhs) { lhs.swap(rhs); }
+
+// #pragma mark - Public ADS_mapped_set methods
+
+template <typename Key, size_t N>
+ADS_mapped_set<Key,N>::ADS_mapped_set(const std::string& path) : base(nullptr), bytes(0), header(nullptr) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("cannot open file! ADS_mapped_set");
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || size_t(info.st_size) < header_size) {
+        ::close(fd);
+        throw runtime_error("no header! ADS_mapped_set");
+    }
+    bytes = size_t(info.st_size);
+    void* mapping = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps the file alive
+    if (mapping == MAP_FAILED) {
+        throw runtime_error("mmap failed! ADS_mapped_set");
+    }
+    base = static_cast<const char*>(mapping);
+    header = reinterpret_cast<const File_header*>(base);
+
+    const char* error = nullptr;
+    if (std::memcmp(header->magic, file_magic, sizeof(header->magic)) != 0 || header->version != file_version) {
+        error = "not an ADS_mapped_set file! ADS_mapped_set";
+    } else if (header->key_size != sizeof(key_type) || header->node_keys != max_keys) {
+        error = "key size or node size does not match! ADS_mapped_set";
+    } else if (header->bytes != bytes || (header->count && (header->root < header_size || header->root > bytes - leaf_size))) {
+        error = "file is truncated! ADS_mapped_set";
+    }
+    if (error) {
+        ::munmap(const_cast<char*>(base), bytes);
+        throw runtime_error(error);
+    }
+}
+
+template <typename Key, size_t N>
+ADS_mapped_set<Key,N>::ADS_mapped_set(ADS_mapped_set&& other) : base(other.base), bytes(other.bytes), header(other.header) {
+    other.base = nullptr;
+    other.bytes = 0;
+    other.header = nullptr;
+}
+
+template <typename Key, size_t N>
+ADS_mapped_set<Key,N>& ADS_mapped_set<Key,N>::operator=(ADS_mapped_set&& other) {
+    ADS_mapped_set moved(std::move(other));
+    swap(moved);
+    return *this;
+}
+
+template <typename Key, size_t N>
+ADS_mapped_set<Key,N>::~ADS_mapped_set() {
+    if (base) {
+        ::munmap(const_cast<char*>(base), bytes);
+    }
+}
+
+template <typename Key, size_t N>
+void ADS_mapped_set<Key,N>::swap(ADS_mapped_set& other) {
+    std::swap(base, other.base);
+    std::swap(bytes, other.bytes);
+    std::swap(header, other.header);
+}
+
+template <typename Key, size_t N>
+template <size_t M, typename Allocator, size_t LeafM, size_t InternalM>
+void ADS_mapped_set<Key,N>::write(const ADS_set<Key,M,Allocator,std::less<Key>,LeafM,InternalM>& set, const std::string& path) {
+    std::ofstream o(path, std::ios::binary | std::ios::trunc);
+    if (!o) {
+        throw runtime_error("cannot open file! write");
+    }
+
+    File_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, file_magic, sizeof(header.magic));
+    header.version = file_version;
+    header.key_size = sizeof(key_type);
+    header.node_keys = max_keys;
+    header.count = set.size();
+    if (!set.empty()) {
+        size_t leafs = (set.size() + max_keys - 1) / max_keys;
+        header.first_leaf = header_size;
+        header.bytes = header_size + leafs * leaf_size;
+        for (size_t nodes = leafs; nodes > 1; ) {
+            nodes = (nodes + max_keys) / (max_keys+1);
+            header.bytes += nodes * internal_size;
+        }
+        header.root = header.bytes - (leafs > 1 ? internal_size : leaf_size);
+    } else {
+        header.bytes = header_size;
+    }
+    o.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write_padding(o, header_size - sizeof(header));
+
+    // leafs are filled completely, only the last one may be short
+    std::vector<Level_entry> level;
+    uint64_t offset = header_size;
+    auto it = set.begin();
+    for (size_t left = set.size(); left; ) {
+        Node_header leaf;
+        std::memset(&leaf, 0, sizeof(leaf));
+        leaf.keys_counter = uint32_t(std::min<size_t>(left, size_t(max_keys)));
+        leaf.leaf = 1;
+        left -= leaf.keys_counter;
+        leaf.next = left ? offset + leaf_size : 0;
+        level.push_back(Level_entry{offset, *it});
+
+        o.write(reinterpret_cast<const char*>(&leaf), sizeof(leaf));
+        write_padding(o, keys_offset - sizeof(leaf));
+        for (uint32_t i = 0; i < leaf.keys_counter; ++i, ++it) {
+            key_type key = *it;
+            o.write(reinterpret_cast<const char*>(&key), sizeof(key));
+        }
+        write_padding(o, leaf_size - keys_offset - leaf.keys_counter * sizeof(key_type));
+        offset += leaf_size;
+    }
+
+    // every internal level groups up to 2N+1 nodes of the level below
+    while (level.size() > 1) {
+        std::vector<Level_entry> parents;
+        for (size_t first = 0; first < level.size(); first += max_keys+1) {
+            size_t children = std::min<size_t>(level.size() - first, max_keys+1);
+            Node_header internal;
+            std::memset(&internal, 0, sizeof(internal));
+            internal.keys_counter = uint32_t(children - 1);
+            parents.push_back(Level_entry{offset, level[first].first});
+
+            o.write(reinterpret_cast<const char*>(&internal), sizeof(internal));
+            write_padding(o, keys_offset - sizeof(internal));
+            for (size_t i = 1; i < children; ++i) {
+                o.write(reinterpret_cast<const char*>(&level[first+i].first), sizeof(key_type));
+            }
+            write_padding(o, children_offset - keys_offset - internal.keys_counter * sizeof(key_type));
+            for (size_t i = 0; i < children; ++i) {
+                o.write(reinterpret_cast<const char*>(&level[first+i].offset), sizeof(uint64_t));
+            }
+            write_padding(o, internal_size - children_offset - children * sizeof(uint64_t));
+            offset += internal_size;
+        }
+        level.swap(parents);
+    }
+    if (!o.flush() || offset != header.bytes) {
+        throw runtime_error("write failed! write");
+    }
+}
+
+template <typename Key, size_t N>
+typename ADS_mapped_set<Key,N>::size_type ADS_mapped_set<Key,N>::count(const key_type& key) const {
+    return find(key) != end();
+}
+
+template <typename Key, size_t N>
+typename ADS_mapped_set<Key,N>::const_iterator ADS_mapped_set<Key,N>::find(const key_type& key) const {
+    const_iterator it = lower_bound(key);
+    if (it != end() && !key_compare()(key, *it)) {
+        return it;
+    }
+    return end();
+}
+
+template <typename Key, size_t N>
+typename ADS_mapped_set<Key,N>::const_iterator ADS_mapped_set<Key,N>::lower_bound(const key_type& key) const {
+    if (empty()) {
+        return end();
+    }
+    uint64_t leaf = find_leaf(key);
+    const Node_header* current = node(leaf);
+    return Iterator(base, leaf, search::lower(keys_of(current), current->keys_counter, key, key_compare()));
+}
+
+template <typename Key, size_t N>
+typename ADS_mapped_set<Key,N>::const_iterator ADS_mapped_set<Key,N>::upper_bound(const key_type& key) const {
+    if (empty()) {
+        return end();
+    }
+    uint64_t leaf = find_leaf(key);
+    const Node_header* current = node(leaf);
+    return Iterator(base, leaf, search::upper(keys_of(current), current->keys_counter, key, key_compare()));
+}
+
+template <typename Key, size_t N>
+typename ADS_mapped_set<Key,N>::const_iterator ADS_mapped_set<Key,N>::begin() const {
+    if (empty()) {
+        return end();
+    }
+    return Iterator(base, header->first_leaf, 0);
+}
+
+template <typename Key, size_t N>
+typename ADS_mapped_set<Key,N>::const_iterator ADS_mapped_set<Key,N>::end() const {
+    return Iterator(base, 0, 0);
+}
+
+// #pragma mark - Private ADS_mapped_set methods
+
+template <typename Key, size_t N>
+uint64_t ADS_mapped_set<Key,N>::find_leaf(const key_type& key) const {
+    uint64_t offset = header->root;
+    const Node_header* current = node(offset);
+    while (!current->leaf) {
+        unsigned i = search::upper(keys_of(current), current->keys_counter, key, key_compare());
+        offset = children_of(current)[i];
+        current = node(offset);
+    }
+    return offset;
+}
+
+template <typename Key, size_t N>
+void ADS_mapped_set<Key,N>::write_padding(std::ofstream& o, size_t n) {
+    static const char zeros[64] = {};
+    for (; n > sizeof(zeros); n -= sizeof(zeros)) {
+        o.write(zeros, sizeof(zeros));
+    }
+    o.write(zeros, n);
+}
+
+template <typename Key, size_t N>
+constexpr char ADS_mapped_set<Key,N>::file_magic[8];
+
+#endif // ADS_MAPPED_SET_H
@@ -0,0 +1,842 @@
+#ifndef ADS_PAGED_SET_H
+#define ADS_PAGED_SET_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ADS_set.h"
+
+// B+ tree whose nodes are fixed-size pages of a file. pages are reached
+// through a buffer pool of memory_budget / page_size frames: a page is pinned
+// while a node is worked on, unpinned frames are evicted with CLOCK and dirty
+// ones written back first. the fanout follows from the page size. page 0
+// holds the meta data, written by flush() and the destructor.
+// empty leafs are unlinked and their pages reused, nodes are never merged.
+// keys have to be trivially copyable, the file is in the byte order of the machine.
+// every change invalidates iterators
+template <typename Key>
+class ADS_paged_set {
+
+public:
+    class Iterator;
+    using value_type = Key;
+    using key_type = Key;
+    using reference = key_type&;
+    using const_reference = const key_type&;
+    using size_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using iterator = Iterator;
+    using const_iterator = Iterator;
+    using key_compare = std::less<key_type>;
+
+    static_assert(std::is_trivially_copyable<key_type>::value, "paged keys have to be trivially copyable");
+    static_assert(alignof(key_type) <= alignof(std::max_align_t), "paged keys must not be over-aligned");
+
+    static constexpr size_t default_page_size = 4096;
+    static constexpr size_t default_memory_budget = 1 << 20;
+
+    struct Buffer_stats {
+        size_t frames;
+        size_t hits;
+        size_t misses;
+        size_t write_backs;
+    };
+
+private:
+    using search = ADS_search<key_type, key_compare>;
+    using page_id = uint64_t;
+
+    class Buffer_pool;
+    class Page;
+
+    struct Meta {
+        char magic[8];
+        uint32_t version;
+        uint32_t key_size;
+        uint64_t page_size;
+        uint64_t count;
+        page_id root;
+        page_id first_leaf;
+        page_id pages;     // pages in use or on the free list
+        page_id free_head; // 0 when empty, a free page starts with the next one
+    };
+
+    // followed by the keys, internal pages also by the child page ids
+    struct Node_header {
+        uint32_t keys_counter;
+        uint32_t leaf;
+        page_id next; // leafs only, 0 at the ends
+        page_id prev;
+    };
+
+    static constexpr char file_magic[8] = {'A','D','S','_','p','a','g','\0'};
+    static constexpr uint32_t file_version = 1;
+    static constexpr size_t min_frames = 8;
+    static constexpr size_t keys_offset = (sizeof(Node_header) + alignof(key_type) - 1) / alignof(key_type) * alignof(key_type);
+
+    int fd;
+    size_t page_size;
+    size_t leaf_capacity;
+    size_t internal_capacity;
+    size_t children_offset;
+    Meta meta;
+    std::unique_ptr<Buffer_pool> pool;
+
+private:
+    Page fetch(page_id id) const;
+    Page allocate(bool leaf);
+    void release(Page& page);
+    static Node_header* header_of(Page& page);
+    static key_type* keys_of(Page& page);
+    page_id* children_of(Page& page) const;
+
+    void init_meta();
+    page_id find_leaf(const key_type& key, std::vector<std::pair<page_id,unsigned>>* path = nullptr) const;
+    void insert_in_parent(std::vector<std::pair<page_id,unsigned>>& path, key_type separator, page_id child);
+    void remove_from_parent(std::vector<std::pair<page_id,unsigned>>& path);
+
+public:
+    // opens the set in path or creates it, page_size has to match an existing file
+    explicit ADS_paged_set(const std::string& path, size_t memory_budget = default_memory_budget, size_t page_size = default_page_size);
+    ADS_paged_set(const ADS_paged_set&) = delete;
+    ADS_paged_set& operator=(const ADS_paged_set&) = delete;
+    ~ADS_paged_set();
+
+    size_type size() const {
+        return meta.count;
+    }
+    bool empty() const {
+        return meta.count == 0;
+    }
+
+    std::pair<iterator,bool> insert(const key_type& key);
+    void insert(std::initializer_list<key_type> ilist);
+    template<typename InputIt> void insert(InputIt first, InputIt last);
+    size_type erase(const key_type& key);
+    void clear();
+    void swap(ADS_paged_set& other);
+
+    size_type count(const key_type& key) const;
+    iterator find(const key_type& key) const;
+    const_iterator lower_bound(const key_type& key) const;
+    const_iterator upper_bound(const key_type& key) const;
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    // writes the meta data and all dirty pages and syncs the file
+    void flush();
+    Buffer_stats buffer_stats() const;
+    size_t leaf_fanout() const {
+        return leaf_capacity;
+    }
+    size_t internal_fanout() const {
+        return internal_capacity + 1;
+    }
+
+    void dump(std::ostream& o = std::cerr) const;
+
+    friend bool operator==(const ADS_paged_set& lhs, const ADS_paged_set& rhs) {
+        return lhs.size() == rhs.size() && std::equal(lhs.begin(), lhs.end(), rhs.begin(), [] (const_reference a, const_reference b) {
+            return !key_compare()(a, b) && !key_compare()(b, a);
+        });
+    }
+    friend bool operator!=(const ADS_paged_set& lhs, const ADS_paged_set& rhs) {
+        return !(lhs==rhs);
+    }
+};
+
+// the frames of the pool and the page table, a page is read on a miss
+template <typename Key>
+class ADS_paged_set<Key>::Buffer_pool {
+
+    struct Frame {
+        page_id page;
+        unsigned pins;
+        bool used;
+        bool dirty;
+        bool referenced; // CLOCK gives a referenced frame a second chance
+    };
+
+    int fd;
+    size_t page_size;
+    std::vector<Frame> frames;
+    std::unique_ptr<char[]> memory;
+    std::unordered_map<page_id, size_t> table;
+    size_t hand;
+    Buffer_stats stats;
+
+    void read_page(page_id page, char* data) {
+        size_t done = 0;
+        while (done < page_size) {
+            ssize_t n = ::pread(fd, data + done, page_size - done, off_t(page * page_size + done));
+            if (n < 0) {
+                throw runtime_error("read failed! pin");
+            }
+            if (n == 0) {
+                // behind the end of the file, never written yet
+                std::memset(data + done, 0, page_size - done);
+                break;
+            }
+            done += size_t(n);
+        }
+    }
+    void write_page(page_id page, const char* data) {
+        size_t done = 0;
+        while (done < page_size) {
+            ssize_t n = ::pwrite(fd, data + done, page_size - done, off_t(page * page_size + done));
+            if (n <= 0) {
+                throw runtime_error("write failed! write_page");
+            }
+            done += size_t(n);
+        }
+        ++stats.write_backs;
+    }
+    size_t victim() {
+        for (size_t step = 0; step < 2 * frames.size(); ++step) {
+            size_t f = hand;
+            hand = (hand + 1) % frames.size();
+            Frame& frame = frames[f];
+            if (!frame.used) {
+                return f;
+            }
+            if (frame.pins) {
+                continue;
+            }
+            if (frame.referenced) {
+                frame.referenced = false;
+                continue;
+            }
+            return f;
+        }
+        throw runtime_error("all frames are pinned! pin");
+    }
+public:
+    Buffer_pool(int _fd, size_t _page_size, size_t frame_count) : fd(_fd), page_size(_page_size), frames(frame_count, Frame{0, 0, false, false, false}), memory(new char[frame_count * _page_size]), hand(0) {
+        stats = Buffer_stats{frame_count, 0, 0, 0};
+        table.reserve(frame_count);
+    }
+
+    // fresh pages are zeroed instead of read
+    char* pin(page_id page, size_t& f, bool fresh) {
+        auto found = table.find(page);
+        if (found != table.end()) {
+            ++stats.hits;
+            f = found->second;
+            if (fresh) {
+                std::memset(memory.get() + f * page_size, 0, page_size);
+            }
+        } else {
+            ++stats.misses;
+            f = victim();
+            Frame& frame = frames[f];
+            if (frame.used) {
+                if (frame.dirty) {
+                    write_page(frame.page, memory.get() + f * page_size);
+                }
+                table.erase(frame.page);
+            }
+            frame = Frame{page, 0, true, false, false};
+            if (fresh) {
+                std::memset(memory.get() + f * page_size, 0, page_size);
+            } else {
+                try {
+                    read_page(page, memory.get() + f * page_size);
+                } catch (...) {
+                    frame.used = false;
+                    throw;
+                }
+            }
+            table[page] = f;
+        }
+        ++frames[f].pins;
+        frames[f].referenced = true;
+        return memory.get() + f * page_size;
+    }
+    void unpin(size_t f, bool dirty) {
+        --frames[f].pins;
+        frames[f].dirty = frames[f].dirty || dirty;
+    }
+    void flush() {
+        for (size_t f = 0; f < frames.size(); ++f) {
+            if (frames[f].used && frames[f].dirty) {
+                write_page(frames[f].page, memory.get() + f * page_size);
+                frames[f].dirty = false;
+            }
+        }
+    }
+    // forgets every page without writing it
+    void discard() {
+        for (Frame& frame: frames) {
+            frame = Frame{0, 0, false, false, false};
+        }
+        table.clear();
+    }
+    const Buffer_stats& statistics() const {
+        return stats;
+    }
+};
+
+// a pinned page, unpinned when the handle goes away
+template <typename Key>
+class ADS_paged_set<Key>::Page {
+    Buffer_pool* pool;
+    size_t frame;
+    page_id page;
+    char* bytes;
+    bool dirty;
+public:
+    Page(Buffer_pool& _pool, page_id _page, bool fresh) : pool(&_pool), page(_page), dirty(fresh) {
+        bytes = pool->pin(page, frame, fresh);
+    }
+    Page(Page&& other) : pool(other.pool), frame(other.frame), page(other.page), bytes(other.bytes), dirty(other.dirty) {
+        other.pool = nullptr;
+    }
+    Page(const Page&) = delete;
+    Page& operator=(const Page&) = delete;
+    ~Page() {
+        if (pool) {
+            pool->unpin(frame, dirty);
+        }
+    }
+    page_id id() const {
+        return page;
+    }
+    char* data() {
+        return bytes;
+    }
+    void mark_dirty() {
+        dirty = true;
+    }
+};
+
+// forward iterator, keeps a copy of the current key since the page may be evicted
+template <typename Key>
+class ADS_paged_set<Key>::Iterator {
+private:
+    const ADS_paged_set* owner;
+    page_id current; // 0 is end()
+    size_t index;
+    key_type key;
+
+    void load() {
+        if (current) {
+            Page page = owner->fetch(current);
+            key = keys_of(page)[index];
+        }
+    }
+public:
+    using value_type = Key;
+    using difference_type = std::ptrdiff_t;
+    using reference = const value_type&;
+    using pointer = const value_type*;
+    using iterator_category = std::forward_iterator_tag;
+
+    Iterator() : owner(nullptr), current(0), index(0), key() {}
+    explicit Iterator(const ADS_paged_set* _owner, page_id _current, size_t _index) : owner(_owner), current(_current), index(_index), key() {
+        if (current) {
+            Page page = owner->fetch(current);
+            if (index == header_of(page)->keys_counter) {
+                current = header_of(page)->next;
+                index = 0;
+            }
+        }
+        load();
+    }
+    reference operator*() const {
+        return key;
+    }
+    pointer operator->() const {
+        return &key;
+    }
+    Iterator& operator++() {
+        {
+            Page page = owner->fetch(current);
+            if (++index == header_of(page)->keys_counter) {
+                current = header_of(page)->next;
+                index = 0;
+            }
+        }
+        load();
+        return *this;
+    }
+    Iterator operator++(int) {
+        Iterator it = *this;
+        ++*this;
+        return it;
+    }
+
+    friend bool operator==(const Iterator& lhs, const Iterator& rhs) {
+        return lhs.current == rhs.current && lhs.index == rhs.index;
+    }
+    friend bool operator!=(const Iterator& lhs, const Iterator& rhs) {
+        return !(lhs==rhs);
+    }
+};
+
+template <typename Key> void swap(ADS_paged_set<Key>& lhs, ADS_paged_set<Key>& rhs) { lhs.swap(rhs); }
+
+// #pragma mark - Public ADS_paged_set methods
+
+template <typename Key>
+ADS_paged_set<Key>::ADS_paged_set(const std::string& path, size_t memory_budget, size_t _page_size) : fd(-1), page_size(_page_size) {
+    if (page_size % alignof(std::max_align_t) != 0 || page_size < sizeof(Meta)) {
+        throw invalid_argument("page size has to be a multiple of the maximal alignment! ADS_paged_set");
+    }
+    leaf_capacity = (page_size - keys_offset) / sizeof(key_type);
+    // the child ids follow the keys, aligned for page_id
+    internal_capacity = (page_size - keys_offset - sizeof(page_id)) / (sizeof(key_type) + sizeof(page_id));
+    auto children_at = [&] (size_t capacity) {
+        return (keys_offset + capacity * sizeof(key_type) + alignof(page_id) - 1) / alignof(page_id) * alignof(page_id);
+    };
+    while (internal_capacity && children_at(internal_capacity) + (internal_capacity + 1) * sizeof(page_id) > page_size) {
+        --internal_capacity;
+    }
+    children_offset = children_at(internal_capacity);
+    if (leaf_capacity < 3 || internal_capacity < 3) {
+        throw invalid_argument("pages are too small for the key! ADS_paged_set");
+    }
+    size_t frames = memory_budget / page_size;
+    if (frames < min_frames) {
+        throw invalid_argument("memory budget has to fit 8 pages! ADS_paged_set");
+    }
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        throw runtime_error("cannot open file! ADS_paged_set");
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw runtime_error("cannot open file! ADS_paged_set");
+    }
+    pool.reset(new Buffer_pool(fd, page_size, frames));
+
+    if (info.st_size == 0) {
+        init_meta();
+        return;
+    }
+    const char* error = nullptr;
+    if (::pread(fd, &meta, sizeof(meta), 0) != ssize_t(sizeof(meta))) {
+        error = "no header! ADS_paged_set";
+    } else if (std::memcmp(meta.magic, file_magic, sizeof(meta.magic)) != 0 || meta.version != file_version) {
+        error = "not an ADS_paged_set file! ADS_paged_set";
+    } else if (meta.key_size != sizeof(key_type) || meta.page_size != page_size) {
+        error = "key size or page size does not match! ADS_paged_set";
+    }
+    if (error) {
+        pool.reset();
+        ::close(fd);
+        throw runtime_error(error);
+    }
+}
+
+template <typename Key>
+ADS_paged_set<Key>::~ADS_paged_set() {
+    if (pool) {
+        try {
+            flush();
+        } catch (...) {
+            // nothing sensible left to do with a failing disk in a destructor
+        }
+        pool.reset();
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+template <typename Key>
+std::pair<typename ADS_paged_set<Key>::iterator,bool> ADS_paged_set<Key>::insert(const key_type& key) {
+    std::vector<std::pair<page_id,unsigned>> path;
+    page_id leaf_id = find_leaf(key, &path);
+    unsigned index;
+    page_id at;
+    key_type separator;
+    page_id right_id;
+    {
+        Page leaf = fetch(leaf_id);
+        Node_header* header = header_of(leaf);
+        key_type* keys = keys_of(leaf);
+        unsigned n = header->keys_counter;
+        index = search::lower(keys, n, key, key_compare());
+        if (index < n && !key_compare()(key, keys[index])) {
+            return std::make_pair(Iterator(this, leaf_id, index), false);
+        }
+        ++meta.count;
+        leaf.mark_dirty();
+        if (n < leaf_capacity) {
+            std::move_backward(keys + index, keys + n, keys + n + 1);
+            keys[index] = key;
+            ++header->keys_counter;
+            return std::make_pair(Iterator(this, leaf_id, index), true);
+        }
+
+        // the full leaf and the new key are split in halfs
+        std::vector<key_type> combined(keys, keys + n);
+        combined.insert(combined.begin() + index, key);
+        unsigned half = unsigned(combined.size() / 2);
+        Page right = allocate(true);
+        Node_header* right_header = header_of(right);
+        std::copy(combined.begin(), combined.begin() + half, keys);
+        std::copy(combined.begin() + half, combined.end(), keys_of(right));
+        header->keys_counter = half;
+        right_header->keys_counter = unsigned(combined.size()) - half;
+
+        right_header->next = header->next;
+        right_header->prev = leaf_id;
+        if (header->next) {
+            Page after = fetch(header->next);
+            header_of(after)->prev = right.id();
+            after.mark_dirty();
+        }
+        header->next = right.id();
+
+        separator = keys_of(right)[0];
+        right_id = right.id();
+        at = index < half ? leaf_id : right_id;
+        index = index < half ? index : index - half;
+    }
+    insert_in_parent(path, separator, right_id);
+    return std::make_pair(Iterator(this, at, index), true);
+}
+
+template <typename Key>
+void ADS_paged_set<Key>::insert(std::initializer_list<key_type> ilist) {
+    insert(ilist.begin(), ilist.end());
+}
+
+template <typename Key>
+template<typename InputIt>
+void ADS_paged_set<Key>::insert(InputIt first, InputIt last) {
+    for (; first != last; ++first) {
+        insert(*first);
+    }
+}
+
+template <typename Key>
+typename ADS_paged_set<Key>::size_type ADS_paged_set<Key>::erase(const key_type& key) {
+    std::vector<std::pair<page_id,unsigned>> path;
+    page_id leaf_id = find_leaf(key, &path);
+    page_id prev, next;
+    {
+        Page leaf = fetch(leaf_id);
+        Node_header* header = header_of(leaf);
+        key_type* keys = keys_of(leaf);
+        unsigned n = header->keys_counter;
+        unsigned index = search::lower(keys, n, key, key_compare());
+        if (index == n || key_compare()(key, keys[index])) {
+            return 0;
+        }
+        std::move(keys + index + 1, keys + n, keys + index);
+        --header->keys_counter;
+        --meta.count;
+        leaf.mark_dirty();
+        if (header->keys_counter || leaf_id == meta.root) {
+            return 1;
+        }
+
+        // an empty leaf leaves the chain and the tree
+        prev = header->prev;
+        next = header->next;
+        release(leaf);
+    }
+    if (prev) {
+        Page before = fetch(prev);
+        header_of(before)->next = next;
+        before.mark_dirty();
+    } else {
+        meta.first_leaf = next;
+    }
+    if (next) {
+        Page after = fetch(next);
+        header_of(after)->prev = prev;
+        after.mark_dirty();
+    }
+    remove_from_parent(path);
+    return 1;
+}
+
+template <typename Key>
+void ADS_paged_set<Key>::clear() {
+    pool->discard();
+    if (::ftruncate(fd, 0) != 0) {
+        throw runtime_error("truncate failed! clear");
+    }
+    init_meta();
+}
+
+template <typename Key>
+void ADS_paged_set<Key>::swap(ADS_paged_set& other) {
+    std::swap(fd, other.fd);
+    std::swap(page_size, other.page_size);
+    std::swap(leaf_capacity, other.leaf_capacity);
+    std::swap(internal_capacity, other.internal_capacity);
+    std::swap(children_offset, other.children_offset);
+    std::swap(meta, other.meta);
+    std::swap(pool, other.pool);
+}
+
+template <typename Key>
+typename ADS_paged_set<Key>::size_type ADS_paged_set<Key>::count(const key_type& key) const {
+    Page leaf = fetch(find_leaf(key));
+    const key_type* keys = keys_of(leaf);
+    unsigned n = header_of(leaf)->keys_counter;
+    unsigned index = search::lower(keys, n, key, key_compare());
+    return index < n && !key_compare()(key, keys[index]);
+}
+
+template <typename Key>
+typename ADS_paged_set<Key>::iterator ADS_paged_set<Key>::find(const key_type& key) const {
+    const_iterator it = lower_bound(key);
+    if (it != end() && !key_compare()(key, *it)) {
+        return it;
+    }
+    return end();
+}
+
+template <typename Key>
+typename ADS_paged_set<Key>::const_iterator ADS_paged_set<Key>::lower_bound(const key_type& key) const {
+    page_id leaf_id = find_leaf(key);
+    unsigned index;
+    {
+        Page leaf = fetch(leaf_id);
+        index = search::lower(keys_of(leaf), header_of(leaf)->keys_counter, key, key_compare());
+    }
+    return Iterator(this, leaf_id, index);
+}
+
+template <typename Key>
+typename ADS_paged_set<Key>::const_iterator ADS_paged_set<Key>::upper_bound(const key_type& key) const {
+    page_id leaf_id = find_leaf(key);
+    unsigned index;
+    {
+        Page leaf = fetch(leaf_id);
+        index = search::upper(keys_of(leaf), header_of(leaf)->keys_counter, key, key_compare());
+    }
+    return Iterator(this, leaf_id, index);
+}
+
+template <typename Key>
+typename ADS_paged_set<Key>::const_iterator ADS_paged_set<Key>::begin() const {
+    return Iterator(this, meta.first_leaf, 0);
+}
+
+template <typename Key>
+typename ADS_paged_set<Key>::const_iterator ADS_paged_set<Key>::end() const {
+    return Iterator(this, 0, 0);
+}
+
+template <typename Key>
+void ADS_paged_set<Key>::flush() {
+    {
+        Page first = fetch(0);
+        std::memcpy(first.data(), &meta, sizeof(meta));
+        first.mark_dirty();
+    }
+    pool->flush();
+    if (::fsync(fd) != 0) {
+        throw runtime_error("sync failed! flush");
+    }
+}
+
+template <typename Key>
+typename ADS_paged_set<Key>::Buffer_stats ADS_paged_set<Key>::buffer_stats() const {
+    return pool->statistics();
+}
+
+template <typename Key>
+void ADS_paged_set<Key>::dump(std::ostream& o) const {
+    o << "size: " << meta.count << ", pages: " << meta.pages << ", root: " << meta.root
+      << ", leaf fanout: " << leaf_fanout() << ", internal fanout: " << internal_fanout() << '\n';
+    for (page_id id = meta.first_leaf; id; ) {
+        Page leaf = fetch(id);
+        o << "[" << id << ":";
+        for (unsigned i = 0; i < header_of(leaf)->keys_counter; ++i) {
+            o << " " << keys_of(leaf)[i];
+        }
+        o << "] ";
+        id = header_of(leaf)->next;
+    }
+    o << '\n';
+}
+
+// #pragma mark - Private ADS_paged_set methods
+
+template <typename Key>
+typename ADS_paged_set<Key>::Page ADS_paged_set<Key>::fetch(page_id id) const {
+    return Page(*pool, id, false);
+}
+
+// reuses the first free page if there is one
+template <typename Key>
+typename ADS_paged_set<Key>::Page ADS_paged_set<Key>::allocate(bool leaf) {
+    page_id id;
+    if (meta.free_head) {
+        id = meta.free_head;
+        Page page = fetch(id);
+        std::memcpy(&meta.free_head, page.data(), sizeof(page_id));
+    } else {
+        id = meta.pages++;
+    }
+    Page page(*pool, id, true);
+    header_of(page)->leaf = leaf;
+    return page;
+}
+
+template <typename Key>
+void ADS_paged_set<Key>::release(Page& page) {
+    std::memcpy(page.data(), &meta.free_head, sizeof(page_id));
+    meta.free_head = page.id();
+    page.mark_dirty();
+}
+
+template <typename Key>
+typename ADS_paged_set<Key>::Node_header* ADS_paged_set<Key>::header_of(Page& page) {
+    return reinterpret_cast<Node_header*>(page.data());
+}
+
+template <typename Key>
+typename ADS_paged_set<Key>::key_type* ADS_paged_set<Key>::keys_of(Page& page) {
+    return reinterpret_cast<key_type*>(page.data() + keys_offset);
+}
+
+template <typename Key>
+typename ADS_paged_set<Key>::page_id* ADS_paged_set<Key>::children_of(Page& page) const {
+    return reinterpret_cast<page_id*>(page.data() + children_offset);
+}
+
+template <typename Key>
+void ADS_paged_set<Key>::init_meta() {
+    std::memset(&meta, 0, sizeof(meta));
+    std::memcpy(meta.magic, file_magic, sizeof(meta.magic));
+    meta.version = file_version;
+    meta.key_size = sizeof(key_type);
+    meta.page_size = page_size;
+    meta.pages = 1;
+    Page root = allocate(true);
+    meta.root = meta.first_leaf = root.id();
+}
+
+// records the page and the child index of every internal node on the way down
+template <typename Key>
+typename ADS_paged_set<Key>::page_id ADS_paged_set<Key>::find_leaf(const key_type& key, std::vector<std::pair<page_id,unsigned>>* path) const {
+    page_id id = meta.root;
+    for (;;) {
+        Page page = fetch(id);
+        if (header_of(page)->leaf) {
+            return id;
+        }
+        unsigned i = search::upper(keys_of(page), header_of(page)->keys_counter, key, key_compare());
+        if (path) {
+            path->push_back(std::make_pair(id, i));
+        }
+        id = children_of(page)[i];
+    }
+}
+
+// puts separator and child right of the recorded child, splits full nodes up to the root
+template <typename Key>
+void ADS_paged_set<Key>::insert_in_parent(std::vector<std::pair<page_id,unsigned>>& path, key_type separator, page_id child) {
+    while (!path.empty()) {
+        Page parent = fetch(path.back().first);
+        unsigned i = path.back().second;
+        path.pop_back();
+        Node_header* header = header_of(parent);
+        key_type* keys = keys_of(parent);
+        page_id* children = children_of(parent);
+        unsigned n = header->keys_counter;
+        parent.mark_dirty();
+        if (n < internal_capacity) {
+            std::move_backward(keys + i, keys + n, keys + n + 1);
+            keys[i] = separator;
+            std::move_backward(children + i + 1, children + n + 1, children + n + 2);
+            children[i+1] = child;
+            ++header->keys_counter;
+            return;
+        }
+
+        // the middle key moves up
+        std::vector<key_type> all_keys(keys, keys + n);
+        all_keys.insert(all_keys.begin() + i, separator);
+        std::vector<page_id> all_children(children, children + n + 1);
+        all_children.insert(all_children.begin() + i + 1, child);
+        size_t middle = all_keys.size() / 2;
+
+        Page right = allocate(false);
+        std::copy(all_keys.begin(), all_keys.begin() + middle, keys);
+        std::copy(all_children.begin(), all_children.begin() + middle + 1, children);
+        header->keys_counter = unsigned(middle);
+        std::copy(all_keys.begin() + middle + 1, all_keys.end(), keys_of(right));
+        std::copy(all_children.begin() + middle + 1, all_children.end(), children_of(right));
+        header_of(right)->keys_counter = unsigned(all_keys.size() - middle - 1);
+
+        separator = all_keys[middle];
+        child = right.id();
+    }
+    Page root = allocate(false);
+    keys_of(root)[0] = separator;
+    children_of(root)[0] = meta.root;
+    children_of(root)[1] = child;
+    header_of(root)->keys_counter = 1;
+    meta.root = root.id();
+}
+
+// the recorded child is gone. internal nodes losing their only child go as well,
+// a root with one child hands over to it
+template <typename Key>
+void ADS_paged_set<Key>::remove_from_parent(std::vector<std::pair<page_id,unsigned>>& path) {
+    bool removed = true;
+    while (removed && !path.empty()) {
+        Page parent = fetch(path.back().first);
+        unsigned i = path.back().second;
+        path.pop_back();
+        Node_header* header = header_of(parent);
+        unsigned n = header->keys_counter;
+        if (n == 0) {
+            release(parent);
+            continue;
+        }
+        key_type* keys = keys_of(parent);
+        page_id* children = children_of(parent);
+        unsigned key_index = i ? i - 1 : 0;
+        std::move(keys + key_index + 1, keys + n, keys + key_index);
+        std::move(children + i + 1, children + n + 1, children + i);
+        --header->keys_counter;
+        parent.mark_dirty();
+        removed = false;
+    }
+    if (removed) {
+        // the last leaf went away with the root above it
+        Page root = allocate(true);
+        meta.root = meta.first_leaf = root.id();
+        return;
+    }
+    for (;;) {
+        Page root = fetch(meta.root);
+        if (header_of(root)->leaf || header_of(root)->keys_counter) {
+            return;
+        }
+        meta.root = children_of(root)[0];
+        release(root);
+    }
+}
+
+template <typename Key>
+constexpr char ADS_paged_set<Key>::file_magic[8];
+
+#endif // ADS_PAGED_SET_H
@@ -0,0 +1,375 @@
+#ifndef ADS_SEARCH_H
+#define ADS_SEARCH_H
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+// define ADS_NO_SIMD to get the scalar kernels on every target
+#if !defined(ADS_NO_SIMD) && (defined(__AVX2__) || defined(__SSE4_2__) || defined(__SSE2__))
+#include <immintrin.h>
+#endif
+
+// in-node search kernels.
+// lower() is the number of keys less than key, that is the slot of key in a leaf.
+// upper() is the number of keys not greater than key, that is the child to descend into.
+// both expect the first n keys to be sorted.
+// ADS_separator gives the key stored above a leaf split.
+
+namespace ads_simd {
+
+    enum kind { scalar, int32, uint32, int64, uint64, float32, float64 };
+
+    template <typename T>
+    using kind_of = std::integral_constant<kind,
+        std::is_same<T, bool>::value ? scalar :
+        std::is_floating_point<T>::value ? (sizeof(T) == 8 ? float64 : sizeof(T) == 4 ? float32 : scalar) :
+        std::is_integral<T>::value ? (sizeof(T) == 8 ? (std::is_signed<T>::value ? int64 : uint64) :
+                                      sizeof(T) == 4 ? (std::is_signed<T>::value ? int32 : uint32) : scalar) :
+        scalar>;
+
+    inline unsigned popcount(unsigned mask) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_popcount(mask);
+#else
+        return (unsigned)std::bitset<32>(mask).count();
+#endif
+    }
+
+    // scalar fallback, stops at the first key that does not count
+    template <typename T>
+    inline unsigned count_less(const T* keys, unsigned n, T key, unsigned i, unsigned c) {
+        for (; i < n && keys[i] < key; ++i) {
+            ++c;
+        }
+        return c;
+    }
+    template <typename T>
+    inline unsigned count_not_greater(const T* keys, unsigned n, T key, unsigned i, unsigned c) {
+        for (; i < n && !(key < keys[i]); ++i) {
+            ++c;
+        }
+        return c;
+    }
+
+    template <typename T, kind K>
+    inline unsigned lower(const T* keys, unsigned n, T key, std::integral_constant<kind, K>) {
+        return count_less(keys, n, key, 0, 0);
+    }
+    template <typename T, kind K>
+    inline unsigned upper(const T* keys, unsigned n, T key, std::integral_constant<kind, K>) {
+        return count_not_greater(keys, n, key, 0, 0);
+    }
+
+    // SSE2 has no 64 bit integer compare (pcmpgtq is SSE4.2), so on plain x86-64
+    // without -msse4.2 or -mavx2 the 64 bit integer keys get the scalar scan above
+#if !defined(ADS_NO_SIMD) && (defined(__AVX2__) || defined(__SSE4_2__))
+
+    // 64 bit integers, unsigned ones are compared signed after flipping the sign bit.
+    // every block is compared at once, the popcount of the mask is the number of hits
+    // and since keys are sorted a block that is not full ends the search
+    template <typename T>
+    inline unsigned lower64(const T* keys, unsigned n, T key, int64_t bias) {
+        unsigned i = 0, c = 0;
+#if defined(__AVX2__)
+        const __m256i b = _mm256_set1_epi64x(bias);
+        const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x((int64_t)key), b);
+        for (; i + 4 <= n; i += 4) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), b);
+            unsigned mask = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(k, v)));
+            c += popcount(mask);
+            if (mask != 0xF) {
+                return c;
+            }
+        }
+#else
+        const __m128i b = _mm_set1_epi64x(bias);
+        const __m128i k = _mm_xor_si128(_mm_set1_epi64x((int64_t)key), b);
+        for (; i + 2 <= n; i += 2) {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), b);
+            unsigned mask = (unsigned)_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(k, v)));
+            c += popcount(mask);
+            if (mask != 0x3) {
+                return c;
+            }
+        }
+#endif
+        return count_less(keys, n, key, i, c);
+    }
+    template <typename T>
+    inline unsigned upper64(const T* keys, unsigned n, T key, int64_t bias) {
+        unsigned i = 0, c = 0;
+#if defined(__AVX2__)
+        const __m256i b = _mm256_set1_epi64x(bias);
+        const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x((int64_t)key), b);
+        for (; i + 4 <= n; i += 4) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), b);
+            unsigned mask = ~(unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, k))) & 0xF;
+            c += popcount(mask);
+            if (mask != 0xF) {
+                return c;
+            }
+        }
+#else
+        const __m128i b = _mm_set1_epi64x(bias);
+        const __m128i k = _mm_xor_si128(_mm_set1_epi64x((int64_t)key), b);
+        for (; i + 2 <= n; i += 2) {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), b);
+            unsigned mask = ~(unsigned)_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, k))) & 0x3;
+            c += popcount(mask);
+            if (mask != 0x3) {
+                return c;
+            }
+        }
+#endif
+        return count_not_greater(keys, n, key, i, c);
+    }
+
+    template <typename T>
+    inline unsigned lower(const T* keys, unsigned n, T key, std::integral_constant<kind, int64>) {
+        return lower64(keys, n, key, 0);
+    }
+    template <typename T>
+    inline unsigned upper(const T* keys, unsigned n, T key, std::integral_constant<kind, int64>) {
+        return upper64(keys, n, key, 0);
+    }
+    template <typename T>
+    inline unsigned lower(const T* keys, unsigned n, T key, std::integral_constant<kind, uint64>) {
+        return lower64(keys, n, key, INT64_MIN);
+    }
+    template <typename T>
+    inline unsigned upper(const T* keys, unsigned n, T key, std::integral_constant<kind, uint64>) {
+        return upper64(keys, n, key, INT64_MIN);
+    }
+
+#endif
+
+#if !defined(ADS_NO_SIMD) && (defined(__AVX2__) || defined(__SSE2__))
+
+    // 32 bit integers, same scheme as above with twice the lanes
+    template <typename T>
+    inline unsigned lower32(const T* keys, unsigned n, T key, int32_t bias) {
+        unsigned i = 0, c = 0;
+#if defined(__AVX2__)
+        const __m256i b = _mm256_set1_epi32(bias);
+        const __m256i k = _mm256_xor_si256(_mm256_set1_epi32((int32_t)key), b);
+        for (; i + 8 <= n; i += 8) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), b);
+            unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, v)));
+            c += popcount(mask);
+            if (mask != 0xFF) {
+                return c;
+            }
+        }
+#else
+        const __m128i b = _mm_set1_epi32(bias);
+        const __m128i k = _mm_xor_si128(_mm_set1_epi32((int32_t)key), b);
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), b);
+            unsigned mask = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, v)));
+            c += popcount(mask);
+            if (mask != 0xF) {
+                return c;
+            }
+        }
+#endif
+        return count_less(keys, n, key, i, c);
+    }
+    template <typename T>
+    inline unsigned upper32(const T* keys, unsigned n, T key, int32_t bias) {
+        unsigned i = 0, c = 0;
+#if defined(__AVX2__)
+        const __m256i b = _mm256_set1_epi32(bias);
+        const __m256i k = _mm256_xor_si256(_mm256_set1_epi32((int32_t)key), b);
+        for (; i + 8 <= n; i += 8) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), b);
+            unsigned mask = ~(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, k))) & 0xFF;
+            c += popcount(mask);
+            if (mask != 0xFF) {
+                return c;
+            }
+        }
+#else
+        const __m128i b = _mm_set1_epi32(bias);
+        const __m128i k = _mm_xor_si128(_mm_set1_epi32((int32_t)key), b);
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), b);
+            unsigned mask = ~(unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, k))) & 0xF;
+            c += popcount(mask);
+            if (mask != 0xF) {
+                return c;
+            }
+        }
+#endif
+        return count_not_greater(keys, n, key, i, c);
+    }
+
+    template <typename T>
+    inline unsigned lower(const T* keys, unsigned n, T key, std::integral_constant<kind, int32>) {
+        return lower32(keys, n, key, 0);
+    }
+    template <typename T>
+    inline unsigned upper(const T* keys, unsigned n, T key, std::integral_constant<kind, int32>) {
+        return upper32(keys, n, key, 0);
+    }
+    template <typename T>
+    inline unsigned lower(const T* keys, unsigned n, T key, std::integral_constant<kind, uint32>) {
+        return lower32(keys, n, key, INT32_MIN);
+    }
+    template <typename T>
+    inline unsigned upper(const T* keys, unsigned n, T key, std::integral_constant<kind, uint32>) {
+        return upper32(keys, n, key, INT32_MIN);
+    }
+
+    // floating point, ordered compares so that the result matches operator<
+    inline unsigned lower(const double* keys, unsigned n, double key, std::integral_constant<kind, float64>) {
+        unsigned i = 0, c = 0;
+#if defined(__AVX2__)
+        const __m256d k = _mm256_set1_pd(key);
+        for (; i + 4 <= n; i += 4) {
+            unsigned mask = (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(keys + i), k, _CMP_LT_OQ));
+            c += popcount(mask);
+            if (mask != 0xF) {
+                return c;
+            }
+        }
+#else
+        const __m128d k = _mm_set1_pd(key);
+        for (; i + 2 <= n; i += 2) {
+            unsigned mask = (unsigned)_mm_movemask_pd(_mm_cmplt_pd(_mm_loadu_pd(keys + i), k));
+            c += popcount(mask);
+            if (mask != 0x3) {
+                return c;
+            }
+        }
+#endif
+        return count_less(keys, n, key, i, c);
+    }
+    inline unsigned upper(const double* keys, unsigned n, double key, std::integral_constant<kind, float64>) {
+        unsigned i = 0, c = 0;
+#if defined(__AVX2__)
+        const __m256d k = _mm256_set1_pd(key);
+        for (; i + 4 <= n; i += 4) {
+            unsigned mask = (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(keys + i), k, _CMP_LE_OQ));
+            c += popcount(mask);
+            if (mask != 0xF) {
+                return c;
+            }
+        }
+#else
+        const __m128d k = _mm_set1_pd(key);
+        for (; i + 2 <= n; i += 2) {
+            unsigned mask = (unsigned)_mm_movemask_pd(_mm_cmple_pd(_mm_loadu_pd(keys + i), k));
+            c += popcount(mask);
+            if (mask != 0x3) {
+                return c;
+            }
+        }
+#endif
+        return count_not_greater(keys, n, key, i, c);
+    }
+    inline unsigned lower(const float* keys, unsigned n, float key, std::integral_constant<kind, float32>) {
+        unsigned i = 0, c = 0;
+#if defined(__AVX2__)
+        const __m256 k = _mm256_set1_ps(key);
+        for (; i + 8 <= n; i += 8) {
+            unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(keys + i), k, _CMP_LT_OQ));
+            c += popcount(mask);
+            if (mask != 0xFF) {
+                return c;
+            }
+        }
+#else
+        const __m128 k = _mm_set1_ps(key);
+        for (; i + 4 <= n; i += 4) {
+            unsigned mask = (unsigned)_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(keys + i), k));
+            c += popcount(mask);
+            if (mask != 0xF) {
+                return c;
+            }
+        }
+#endif
+        return count_less(keys, n, key, i, c);
+    }
+    inline unsigned upper(const float* keys, unsigned n, float key, std::integral_constant<kind, float32>) {
+        unsigned i = 0, c = 0;
+#if defined(__AVX2__)
+        const __m256 k = _mm256_set1_ps(key);
+        for (; i + 8 <= n; i += 8) {
+            unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(keys + i), k, _CMP_LE_OQ));
+            c += popcount(mask);
+            if (mask != 0xFF) {
+                return c;
+            }
+        }
+#else
+        const __m128 k = _mm_set1_ps(key);
+        for (; i + 4 <= n; i += 4) {
+            unsigned mask = (unsigned)_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(keys + i), k));
+            c += popcount(mask);
+            if (mask != 0xF) {
+                return c;
+            }
+        }
+#endif
+        return count_not_greater(keys, n, key, i, c);
+    }
+
+#endif
+}
+
+// generic keys and comparators get a binary search. key may be of any type the
+// comparator orders against Key (transparent comparators), it is never converted
+template <typename Key, typename Compare, typename Enable = void>
+struct ADS_search {
+    template <typename K>
+    static unsigned lower(const Key* keys, unsigned n, const K& key, const Compare& compare) {
+        return (unsigned)(std::lower_bound(keys, keys + n, key, compare) - keys);
+    }
+    template <typename K>
+    static unsigned upper(const Key* keys, unsigned n, const K& key, const Compare& compare) {
+        return (unsigned)(std::upper_bound(keys, keys + n, key, compare) - keys);
+    }
+};
+
+// arithmetic keys ordered by std::less go through the block compare kernels
+template <typename Key>
+struct ADS_search<Key, std::less<Key>, typename std::enable_if<std::is_arithmetic<Key>::value>::type> {
+    static unsigned lower(const Key* keys, unsigned n, Key key, const std::less<Key>&) {
+        return ads_simd::lower(keys, n, key, ads_simd::kind_of<Key>());
+    }
+    static unsigned upper(const Key* keys, unsigned n, Key key, const std::less<Key>&) {
+        return ads_simd::upper(keys, n, key, ads_simd::kind_of<Key>());
+    }
+};
+
+// any key in (left, right] separates two leafs, by default the first key of the right one
+template <typename Key, typename Compare, typename Enable = void>
+struct ADS_separator {
+    static const Key& shorten(const Key&, const Key& right) {
+        return right;
+    }
+};
+
+// strings keep the shortest prefix of right that is still greater than left,
+// that is up to and including the first character where the two differ
+template <typename C, typename T, typename A>
+struct ADS_separator<std::basic_string<C,T,A>, std::less<std::basic_string<C,T,A>>> {
+    using string = std::basic_string<C,T,A>;
+    
+    static string shorten(const string& left, const string& right) {
+        size_t n = std::min(left.size(), right.size()), i = 0;
+        while (i < n && T::eq(left[i], right[i])) {
+            ++i;
+        }
+        return right.substr(0, i + 1);
+    }
+};
+// std::less<> orders strings the same way
+template <typename C, typename T, typename A>
+struct ADS_separator<std::basic_string<C,T,A>, std::less<void>> : ADS_separator<std::basic_string<C,T,A>, std::less<std::basic_string<C,T,A>>> {};
+
+#endif // ADS_SEARCH_H
@@ -4,17 +4,220 @@
 #include <functional>
 #include <algorithm>
 #include <iostream>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <type_traits>
+#include <vector>
 
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "ADS_search.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ADS_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define ADS_PREFETCH(address) ((void)(address))
+#endif
 
 using namespace std;
 
-template <typename Key, size_t N = 32>
+// bytes a node is sized to when the fanout is derived, both multiples of the cache line
+#ifndef ADS_LEAF_BYTES
+#define ADS_LEAF_BYTES 1024
+#endif
+#ifndef ADS_INTERNAL_BYTES
+#define ADS_INTERNAL_BYTES 2048
+#endif
+
+// node geometry for a key type. n is the least number of keys of a node that
+// is not the root, it holds up to 2n. leaf() and internal() give the largest n
+// whose node still fits into the given bytes, never less than 2
+template <typename Key>
+struct ADS_fanout {
+    static constexpr size_t cache_line = 64;
+    // parent, counters and flags, rounded up so the keys still fit when they are aligned
+    static constexpr size_t header = 4 * sizeof(void*);
+    // keys below every child, kept for the order statistics
+    static constexpr size_t count_bytes = sizeof(size_t);
+    
+    static constexpr size_t at_least_two(size_t n) {
+        return n < 2 ? 2 : n;
+    }
+    // largest n for a node of fixed bytes plus 2n slots, the other containers size their nodes with it
+    static constexpr size_t fit(size_t bytes, size_t fixed, size_t slot) {
+        return bytes < fixed + 4 * slot ? 2 : at_least_two((bytes - fixed) / (2 * slot));
+    }
+    // 2n+1 keys (one spare for the split), next and prev
+    static constexpr size_t leaf(size_t bytes) {
+        return fit(bytes, header + 2 * sizeof(void*) + sizeof(Key), sizeof(Key));
+    }
+    // 2n+1 keys, 2n+2 children and as many counts
+    static constexpr size_t internal(size_t bytes) {
+        return fit(bytes, header + sizeof(Key) + 2 * (sizeof(void*) + count_bytes), sizeof(Key) + sizeof(void*) + count_bytes);
+    }
+};
+
+// slab pool for one node type, every slab comes from the allocator rebound to it.
+// nodes freed by merges are kept in a free list and handed out again
+template <typename T, typename Allocator>
+class ADS_node_pool {
+    using storage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+    using storage_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<storage>;
+    using storage_traits = std::allocator_traits<storage_allocator>;
+    
+    // the first node slot of every slab holds its header
+    struct Slab {
+        storage* next;
+        size_t capacity;
+    };
+    static_assert(sizeof(Slab) <= sizeof(storage), "node too small for slab header");
+    
+    static constexpr size_t max_slab_nodes = sizeof(T) >= (1 << 16) ? 1 : (1 << 16) / sizeof(T);
+    
+    storage_allocator allocator;
+    storage* slabs;
+    size_t used;
+    void* free_list;
+    
+    // allocators that do not propagate on swap stay (and have to compare equal)
+    static void swap_allocators(storage_allocator& a, storage_allocator& b, std::true_type) { using std::swap; swap(a, b); }
+    static void swap_allocators(storage_allocator&, storage_allocator&, std::false_type) {}
+public:
+    explicit ADS_node_pool(const Allocator&);
+    ~ADS_node_pool();
+    
+    void* allocate();
+    void deallocate(void*);
+    void release();
+    void swap(ADS_node_pool&);
+    // Propagate true_type takes the allocators along whatever the traits say
+    template <typename Propagate> void swap(ADS_node_pool&, Propagate);
+    void absorb(ADS_node_pool&);
+    
+    Allocator get_allocator() const;
+};
+
+//#pragma mark - ADS_node_pool methods
+
+template <typename T, typename Allocator>
+ADS_node_pool<T,Allocator>::ADS_node_pool(const Allocator& alloc): allocator(alloc) {
+    slabs = nullptr;
+    used = 0;
+    free_list = nullptr;
+}
+
+template <typename T, typename Allocator>
+ADS_node_pool<T,Allocator>::~ADS_node_pool() {
+    release();
+}
+
+template <typename T, typename Allocator>
+void* ADS_node_pool<T,Allocator>::allocate() {
+    if (free_list) {
+        void *node = free_list;
+        free_list = *static_cast<void**>(node);
+        return node;
+    }
+    
+    // newest slab is full, the next one is twice as big up to max_slab_nodes
+    if (!slabs || used == reinterpret_cast<Slab*>(slabs)->capacity) {
+        size_t capacity = slabs ? std::min(2 * reinterpret_cast<Slab*>(slabs)->capacity, size_t(max_slab_nodes)) : 4;
+        storage *slab = storage_traits::allocate(allocator, capacity + 1);
+        new (slab) Slab{slabs, capacity};
+        slabs = slab;
+        used = 0;
+    }
+    return slabs + 1 + used++;
+}
+
+template <typename T, typename Allocator>
+void ADS_node_pool<T,Allocator>::deallocate(void* node) {
+    *static_cast<void**>(node) = free_list;
+    free_list = node;
+}
+
+template <typename T, typename Allocator>
+void ADS_node_pool<T,Allocator>::release() {
+    while (slabs) {
+        storage *slab = slabs;
+        Slab header = *reinterpret_cast<Slab*>(slab);
+        storage_traits::deallocate(allocator, slab, header.capacity + 1);
+        slabs = header.next;
+    }
+    used = 0;
+    free_list = nullptr;
+}
+
+template <typename T, typename Allocator>
+void ADS_node_pool<T,Allocator>::swap(ADS_node_pool& other) {
+    swap(other, typename storage_traits::propagate_on_container_swap());
+}
+template <typename T, typename Allocator>
+template <typename Propagate>
+void ADS_node_pool<T,Allocator>::swap(ADS_node_pool& other, Propagate propagate) {
+    using std::swap;
+    swap_allocators(allocator, other.allocator, propagate);
+    swap(slabs, other.slabs);
+    swap(used, other.used);
+    swap(free_list, other.free_list);
+}
+
+// the slabs of other are hung behind our newest one, which is still the one being
+// filled. the allocators compare equal. the unused rest of the slab other was
+// filling stays unused
+template <typename T, typename Allocator>
+void ADS_node_pool<T,Allocator>::absorb(ADS_node_pool& other) {
+    if (!other.slabs) {
+        return;
+    }
+    if (!slabs) {
+        swap(other);
+        return;
+    }
+    storage *tail = other.slabs;
+    while (reinterpret_cast<Slab*>(tail)->next) {
+        tail = reinterpret_cast<Slab*>(tail)->next;
+    }
+    reinterpret_cast<Slab*>(tail)->next = reinterpret_cast<Slab*>(slabs)->next;
+    reinterpret_cast<Slab*>(slabs)->next = other.slabs;
+    
+    if (other.free_list) {
+        void *node = other.free_list;
+        while (*static_cast<void**>(node)) {
+            node = *static_cast<void**>(node);
+        }
+        *static_cast<void**>(node) = free_list;
+        free_list = other.free_list;
+    }
+    other.slabs = nullptr;
+    other.used = 0;
+    other.free_list = nullptr;
+}
+
+template <typename T, typename Allocator>
+Allocator ADS_node_pool<T,Allocator>::get_allocator() const {
+    return Allocator(allocator);
+}
+
+// immutable pointer-free copy of a set, see ADS_frozen_set.h
+template <typename Key, typename Compare, typename Allocator>
+class ADS_frozen_set;
+
+// N = 0 derives both fanouts from the key size and ADS_LEAF_BYTES / ADS_INTERNAL_BYTES,
+// any other N is the fanout of both node types. LeafN and InternalN override one of them
+template <typename Key, size_t N = 0, typename Allocator = std::allocator<Key>, typename Compare = std::less<Key>, size_t LeafN = N, size_t InternalN = N>
 class ADS_set {
     
 public:
     class Iterator;
+    class Snapshot;
+    class Node_handle;
+    struct Insert_return;
     using value_type = Key;
     using key_type = Key;
     using reference = key_type&;
@@ -23,84 +226,239 @@ public:
     using difference_type = std::ptrdiff_t;
     using iterator = Iterator;
     using const_iterator = Iterator;
-    using key_compare = std::less<key_type>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+    using node_type = Node_handle;
+    using insert_return_type = Insert_return;
+    using frozen_type = ADS_frozen_set<Key, Compare, Allocator>;
+    using key_compare = Compare;
+    using value_compare = Compare;
+    using allocator_type = Allocator;
+    
+    // a leaf holds leaf_n to 2*leaf_n keys, an internal node internal_n to 2*internal_n
+    static constexpr size_t leaf_n = LeafN ? LeafN : ADS_fanout<Key>::leaf(ADS_LEAF_BYTES);
+    static constexpr size_t internal_n = InternalN ? InternalN : ADS_fanout<Key>::internal(ADS_INTERNAL_BYTES);
+    
+private:
+    // in-node search, block compares for arithmetic keys (see ADS_search.h)
+    using search = ADS_search<key_type, key_compare>;
+    // the key a leaf split puts into the parent, strings get cut to the shortest one
+    using separator = ADS_separator<key_type, key_compare>;
+    
+public:
+    class LeafNode;
+    class InternalNode;
     
+    // common header of both node types, keys and children live inline in the derived nodes
     class Node {
         
     public:
-        value_type* keys;
-        Node** children;
-        Node* parent;
-        Node* next;
-        bool leaf;
+        InternalNode* parent;
         unsigned keys_counter;
-        unsigned children_counter;
+        unsigned refs; // parents and snapshots pointing here, more than one means shared
+        bool leaf;
     public:
-        Node();
-        ~Node();
-        int add(const_reference);
-        void set_parent(Node*);
-        void set_next(Node*);
-        void set_leaf(bool);
+        explicit Node(bool _leaf);
+        void set_parent(InternalNode*);
+        value_type* key_array();
+        
+        template <typename K> static int add(value_type* keys, unsigned& keys_counter, K&& key, const key_compare&);
         
         /// dump
-        void keys_printer(ostream&);
+        void keys_printer(ostream&) const;
         inline friend std::ostream& operator<<(std::ostream& os, const Node& node) {
             node.keys_printer(os);
-            if(node.children_counter > 0) {
-                for (size_t i = 0; i < node.children_counter; ++i) {
-                    os << *node.children[i];
+            if(!node.leaf) {
+                const InternalNode& internal = static_cast<const InternalNode&>(node);
+                for (size_t i = 0; i < internal.children_counter; ++i) {
+                    os << *internal.children[i];
                 }
             }
             return os;
         }
     };
     
+    // nodes start on a cache line and fill whole ones
+    class alignas(ADS_fanout<Key>::cache_line) LeafNode : public Node {
+        
+    public:
+        value_type keys[2*leaf_n+1];
+        LeafNode* next;
+        LeafNode* prev;
+    public:
+        LeafNode();
+        template <typename K> int add(K&& key, const key_compare&);
+        void set_next(LeafNode*);
+        void set_prev(LeafNode*);
+    };
+    
+    class alignas(ADS_fanout<Key>::cache_line) InternalNode : public Node {
+        
+    public:
+        unsigned children_counter;
+        value_type keys[2*internal_n+1];
+        Node* children[2*internal_n+2];
+        size_type counts[2*internal_n+2]; // keys below each child
+    public:
+        InternalNode();
+        template <typename K> int add(K&& key, const key_compare&);
+    };
+    
+    // nodes come from slab pools, see ADS_node_pool above
+    template <typename T>
+    using Node_pool = ADS_node_pool<T, Allocator>;
+    
 private:
+    // bytes of a node worth prefetching on the way down: the header and the keys
+    static constexpr size_t key_bytes = sizeof(InternalNode) - sizeof(InternalNode::children) - sizeof(InternalNode::counts);
+    static constexpr size_t prefetch_bytes = key_bytes < 1024 ? key_bytes : 1024;
+    
+    // shared by the set and its snapshots. snapshots that are gone leave their
+    // roots here and the writer drops them, the pools stay on if the set goes first
+    struct Snapshot_state {
+        std::mutex lock;
+        std::vector<Node*> released;
+        std::atomic<size_t> pending;
+        size_t outstanding;
+        bool orphaned;
+        Node_pool<LeafNode> leaf_pool;
+        Node_pool<InternalNode> internal_pool;
+        
+        explicit Snapshot_state(const Allocator&);
+    };
+    struct Snapshot_root {
+        std::shared_ptr<Snapshot_state> state;
+        Node* root;
+        size_type size;
+        key_compare compare;
+        
+        ~Snapshot_root();
+    };
+    
     Node* root;
     int depth;
     unsigned element_counter;
+    double fill_factor;
+    Node_pool<LeafNode> leaf_pool;
+    Node_pool<InternalNode> internal_pool;
+    std::shared_ptr<Snapshot_state> snapshots;
+    key_compare compare;
 private:
     void root_split();
-    void internal_split(Node*);
-    void external_split(Node*);
+    void internal_split(InternalNode*);
+    void external_split(LeafNode*);
 
-    pair<Iterator,bool> insert_private_external(const_reference);
-    int insert_private_internal(Node *current, const_reference key);
+    template <typename K> pair<Iterator,bool> insert_private_external(K&& key);
+    template <typename K> int insert_private_internal(LeafNode *current, K&& key);
     
     bool has_max_num_of_keys(Node *);
     bool is_root(Node* root);
     
-    void shift_left(size_t start, size_t end, Node* current);
-    void shift_right(size_t start, size_t end, Node* current);
+    void shift_left(size_t start, size_t end, value_type* keys);
+    void shift_right(size_t start, size_t end, value_type* keys);
     
     bool equal(const key_type& key, const key_type& to);
     
     size_t index_from_parent(Node* current);
     
-    bool steal_from_right(Node *current, size_t index, std::pair<Node*, size_t>);
-    bool steal_from_left(Node *current, size_t index, std::pair<Node*, size_t>);
-    bool merge_with_left(Node *current, size_t index, const_reference key, std::pair<Node*, size_t>);
-    bool merge_with_right(Node *current, size_t index, const_reference key, std::pair<Node*, size_t>);
+    bool steal_from_right(Node *current, size_t index, std::pair<InternalNode*, size_t>);
+    bool steal_from_left(Node *current, size_t index, std::pair<InternalNode*, size_t>);
+    bool merge_with_left(Node *current, size_t index, const_reference key, std::pair<InternalNode*, size_t>);
+    bool merge_with_right(Node *current, size_t index, const_reference key, std::pair<InternalNode*, size_t>);
     void merge_root();
     
-    void delete_element(Node *current, size_t index);
-    
-    Node* find_leaf(Node*, const_reference &) const;
-    
-    pair<int,bool> binary_search_in_node(Node *, int, int, const_reference) const;
-    
-    Node* find_leaf_with_twin(Node* current, const_reference &key,pair<Node*,int>& twin);
+    /// extract and merge
+    size_type erase_private(const key_type& key, key_type* out);
+    void fix_underfull(Node* current, const_reference key);
+    void join_right(ADS_set& source);
+    template <typename Propagate = typename std::allocator_traits<Allocator>::propagate_on_container_swap> void swap_trees(ADS_set& other, Propagate = Propagate());
+    void move_assign(ADS_set& other, std::true_type);
+    void move_assign(ADS_set& other, std::false_type);
+    
+    /// moved-from and cleared sets own no node, reads see a shared empty leaf
+    Node* top() const;
+    static LeafNode* empty_leaf();
+    void ensure_root();
+    
+    void delete_element(LeafNode *current, size_t index);
+    LeafNode* new_leaf();
+    InternalNode* new_internal();
+    void destroy(Node *current);
+    static void destroy(Node *current, Node_pool<LeafNode>&, Node_pool<InternalNode>&);
+    void destroy_all();
+    
+    /// structural copy, node by node in key order
+    Node* clone(const Node* source, InternalNode* parent, LeafNode*& last_leaf);
+    void clone_from(const ADS_set& other);
+    
+    /// copy on write
+    Node* unshare(Node* current, size_t index);
+    void collect_snapshots();
+    
+    template <typename K> static LeafNode* find_leaf(Node*, const K&, const key_compare&, unsigned* path = nullptr);
+    static void prefetch_node(const Node*);
+    
+    /// order statistics
+    // child indices a descent can record, every internal node has at least two children
+    static constexpr size_t max_depth = 64;
+    LeafNode* touch_path(const unsigned* path, difference_type delta, InternalNode** twin = nullptr);
+    static size_type subtree_size(const Node*);
+    static size_type rank_of(const LeafNode*, size_type index);
+    static LeafNode* select_leaf(Node*, size_type& k);
+    
+    // number of descents interleaved by the batched lookups
+    static constexpr size_t batch_width = 16;
+    template<typename Visit> void find_leaf_many(const key_type* keys, size_type n, Visit visit) const;
+    
+    template <typename K> static pair<int,bool> search_in_node(LeafNode *, const K&, const key_compare&);
+    static LeafNode* successor_leaf(Node* root, const LeafNode*, const key_compare&);
+    
+    LeafNode* find_leaf_with_twin(Node* current, const_reference &key,pair<InternalNode*,int>& twin, unsigned* path);
+    
+    /// bulk load
+    void bulk_load(std::vector<key_type>& sorted);
+    
+    /// binary format: header, then the keys in order as raw bytes
+    struct File_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t key_size;
+        uint64_t count;
+    };
+    static constexpr char file_magic[8] = {'A','D','S','_','s','e','t','\0'};
+    static constexpr uint32_t file_version = 1;
+    static size_t bulk_groups(size_t count, size_t min, size_t target);
+    
+    /// set algebra, both leaf chains are walked in merge order
+    struct Cursor {
+        LeafNode* leaf; // nullptr behind the last key
+        unsigned index;
+    };
+    enum Algebra { union_of, intersection_of, difference_of };
+    static Cursor first_key(Node* root);
+    static void advance(Cursor&);
+    static void gallop(Node* root, Cursor&, const_reference key, std::vector<key_type>* out, const key_compare&);
+    static ADS_set combine(const ADS_set& lhs, const ADS_set& rhs, Algebra);
+    static bool includes_all(const ADS_set& lhs, const ADS_set& rhs);
     
 public:
     void printTree();
     ADS_set();
-    ADS_set(std::initializer_list<key_type> ilist);
-    template<typename InputIt> ADS_set(InputIt first, InputIt last);
+    explicit ADS_set(const Allocator& alloc);
+    // the comparator is copied into the set, it may carry state
+    explicit ADS_set(const Compare& comp, const Allocator& alloc = Allocator());
+    ADS_set(std::initializer_list<key_type> ilist, const Allocator& alloc = Allocator());
+    ADS_set(std::initializer_list<key_type> ilist, const Compare& comp, const Allocator& alloc = Allocator());
+    template<typename InputIt> ADS_set(InputIt first, InputIt last, const Allocator& alloc = Allocator());
+    template<typename InputIt> ADS_set(InputIt first, InputIt last, const Compare& comp, const Allocator& alloc = Allocator());
     ADS_set(const ADS_set& other);
+    // the moved-from set is left empty, it gets a root again when written to
+    ADS_set(ADS_set&& other) noexcept;
     ~ADS_set();
     
     ADS_set& operator=(const ADS_set& other);
+    // allocators that neither propagate nor compare equal get the keys moved one by one
+    ADS_set& operator=(ADS_set&& other) noexcept(std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value || std::allocator_traits<Allocator>::is_always_equal::value);
     ADS_set& operator=(std::initializer_list<key_type> ilist);
     
     size_type size() const;
@@ -108,21 +466,71 @@ public:
     
     size_type count(const key_type& key) const;
     iterator find(const key_type& key) const;
+    // with a transparent comparator (is_transparent, like std::less<>) anything it
+    // orders against keys can be looked up as is, no key_type is built for it
+    template<typename K, typename C = Compare, typename = typename C::is_transparent> size_type count(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent> iterator find(const K& key) const;
+    
+    size_type count_many(const key_type* keys, size_type n, std::vector<bool>& found) const;
+    void find_many(const key_type* keys, size_type n, iterator* result) const;
+    
+    iterator lower_bound(const key_type& key) const;
+    iterator upper_bound(const key_type& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent> iterator lower_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent> iterator upper_bound(const K& key) const;
+    std::pair<iterator,iterator> equal_range(const key_type& key) const;
+    template<typename Visit> size_type scan(const key_type& lo, const key_type& hi, Visit visit) const;
+    
+    size_type rank(const key_type& key) const;
+    const_iterator select(size_type k) const;
+    size_type count_range(const key_type& lo, const key_type& hi) const;
     
     void clear();
     void swap(ADS_set& other);
     
+    allocator_type get_allocator() const;
+    key_compare key_comp() const;
+    value_compare value_comp() const;
+    
     void insert(std::initializer_list<key_type> ilist);
     std::pair<iterator,bool> insert(const key_type& key);
+    std::pair<iterator,bool> insert(key_type&& key);
+    // the key is built first, an equal key already in the set wins
+    template<typename... Args> std::pair<iterator,bool> emplace(Args&&... args);
     template<typename InputIt> void insert(InputIt first, InputIt last);
     
     size_type erase(const key_type& key);
     
+    // the key leaves the set in a handle, it can be changed and inserted into any set of this type
+    node_type extract(const key_type& key);
+    node_type extract(const_iterator position);
+    insert_return_type insert(node_type&& node);
+    // takes the keys of source that are not here yet. when the key ranges do not
+    // overlap the tree of source is joined to ours as a whole, no key is moved
+    void merge(ADS_set& source);
+    
+    void set_fill_factor(double factor);
+    double get_fill_factor() const;
+    
+    // O(1), the writer copies the nodes it changes from then on. has to be
+    // called from the thread that writes the set, the snapshot may go anywhere
+    Snapshot snapshot();
+    // copy of the keys as an implicit tree for sets that are queried far more
+    // often than they change. O(n), needs ADS_frozen_set.h
+    frozen_type freeze() const;
+    
     const_iterator begin() const;
     const_iterator end() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
     
     void dump(std::ostream& o = std::cerr) const;
     
+    // keys have to be trivially copyable, the file is in the byte order of the machine.
+    // load replaces the content and builds the tree bottom-up
+    void save(std::ostream& o) const;
+    void load(std::istream& i);
+    
     friend bool operator==(const ADS_set& lhs, const ADS_set& rhs) {
         if (lhs.element_counter != rhs.element_counter) {
             return false;
@@ -138,23 +546,44 @@ public:
         return !(lhs == rhs);
     }
     
+    // linear in the sizes, runs of one set between two keys of the other are
+    // skipped or copied as a whole. the result is built bottom-up with the allocator of lhs
+    friend ADS_set set_union(const ADS_set& lhs, const ADS_set& rhs) {
+        return combine(lhs, rhs, union_of);
+    }
+    friend ADS_set set_intersection(const ADS_set& lhs, const ADS_set& rhs) {
+        return combine(lhs, rhs, intersection_of);
+    }
+    friend ADS_set set_difference(const ADS_set& lhs, const ADS_set& rhs) {
+        return combine(lhs, rhs, difference_of);
+    }
+    // every key of rhs is in lhs
+    friend bool includes(const ADS_set& lhs, const ADS_set& rhs) {
+        return includes_all(lhs, rhs);
+    }
+    
 };
 
-template <typename Key, size_t N>
-class ADS_set<Key,N>::Iterator {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+class ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Iterator {
 private:
-    Node* current;
-    ADS_set<Key,N> *tree;
+    LeafNode* current;
+    ADS_set<Key,N,Allocator,Compare,LeafN,InternalN> *tree;
     size_t index;
     
+    size_type position() const {
+        return rank_of(current, index);
+    }
 public:
     using value_type = Key;
     using difference_type = std::ptrdiff_t;
     using reference = const value_type&;
     using pointer = const value_type*;
-    using iterator_category = std::forward_iterator_tag;
+    // jumps and differences go through the subtree counts in O(log n)
+    using iterator_category = std::random_access_iterator_tag;
     
-    explicit Iterator(Node* _current, size_type _index) : current(_current), index(_index) {}
+    Iterator() : current(nullptr), tree(nullptr), index(0) {}
+    explicit Iterator(LeafNode* _current, size_type _index) : current(_current), index(_index) {}
     reference operator*() const {
         return current->keys[index];
     }
@@ -185,6 +614,69 @@ public:
         
         return it;
     }
+    Iterator& operator--() {
+        if (index > 0) {
+            --index;
+        } else {
+            current = current->prev;
+            index = current->keys_counter - 1;
+        }
+        
+        return *this;
+    }
+    Iterator operator--(int) {
+        Iterator it = *this;
+        --*this;
+        return it;
+    }
+    Iterator& operator+=(difference_type n) {
+        if (n >= 0 ? index + n < current->keys_counter : index >= size_type(-n)) {
+            index += n;
+            return *this;
+        }
+        Node *top = current;
+        while (top->parent) {
+            top = top->parent;
+        }
+        size_type k = position() + n;
+        current = select_leaf(top, k);
+        index = k;
+        return *this;
+    }
+    Iterator& operator-=(difference_type n) {
+        return *this += -n;
+    }
+    reference operator[](difference_type n) const {
+        return *(*this + n);
+    }
+    
+    friend Iterator operator+(Iterator it, difference_type n) {
+        return it += n;
+    }
+    friend Iterator operator+(difference_type n, Iterator it) {
+        return it += n;
+    }
+    friend Iterator operator-(Iterator it, difference_type n) {
+        return it -= n;
+    }
+    friend difference_type operator-(const Iterator& lhs, const Iterator& rhs) {
+        if (lhs.current == rhs.current) {
+            return difference_type(lhs.index) - difference_type(rhs.index);
+        }
+        return difference_type(lhs.position()) - difference_type(rhs.position());
+    }
+    friend bool operator<(const Iterator& lhs, const Iterator& rhs) {
+        return lhs - rhs < 0;
+    }
+    friend bool operator>(const Iterator& lhs, const Iterator& rhs) {
+        return rhs < lhs;
+    }
+    friend bool operator<=(const Iterator& lhs, const Iterator& rhs) {
+        return !(rhs < lhs);
+    }
+    friend bool operator>=(const Iterator& lhs, const Iterator& rhs) {
+        return !(lhs < rhs);
+    }
     
     friend bool operator==(const Iterator& lhs, const Iterator& rhs) {
         if (lhs.current == rhs.current) {
@@ -199,74 +691,284 @@ public:
     }
 };
 
-template <typename Key, size_t N> void swap(ADS_set<Key,N>& lhs, ADS_set<Key,N>& rhs) { lhs.swap(rhs); }
+// read-only view of the set as it was when snapshot() was called.
+// it only follows child pointers, those of its nodes never change while it is alive
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+class ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Snapshot {
+    friend class ADS_set;
+    std::shared_ptr<const Snapshot_root> version;
+    
+    explicit Snapshot(std::shared_ptr<const Snapshot_root> _version) : version(std::move(_version)) {}
+public:
+    class Iterator;
+    using iterator = Iterator;
+    using const_iterator = Iterator;
+    
+    Snapshot() = default;
+    
+    size_type size() const {
+        return version ? version->size : 0;
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+    size_type count(const key_type& key) const {
+        return version && search_in_node(find_leaf(version->root, key, version->compare), key, version->compare).second;
+    }
+    const_iterator lower_bound(const key_type& key) const;
+    const_iterator begin() const;
+    const_iterator end() const {
+        return Iterator();
+    }
+};
+
+// forward iterator of a snapshot, the next leaf is found from the root again
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+class ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Snapshot::Iterator {
+private:
+    const Snapshot_root* version;
+    LeafNode* current;
+    size_t index;
+    
+public:
+    using value_type = Key;
+    using difference_type = std::ptrdiff_t;
+    using reference = const value_type&;
+    using pointer = const value_type*;
+    using iterator_category = std::forward_iterator_tag;
+    
+    Iterator() : version(nullptr), current(nullptr), index(0) {}
+    explicit Iterator(const Snapshot_root* _version, LeafNode* _current, size_type _index) : version(_version), current(_current), index(_index) {
+        if (current && index == current->keys_counter) {
+            current = successor_leaf(version->root, current, version->compare);
+            index = 0;
+        }
+    }
+    reference operator*() const {
+        return current->keys[index];
+    }
+    pointer operator->() const {
+        return &(current->keys[index]);
+    }
+    Iterator& operator++() {
+        if (++index == current->keys_counter) {
+            current = successor_leaf(version->root, current, version->compare);
+            index = 0;
+        }
+        return *this;
+    }
+    Iterator operator++(int) {
+        Iterator it = *this;
+        ++*this;
+        return it;
+    }
+    
+    friend bool operator==(const Iterator& lhs, const Iterator& rhs) {
+        return lhs.current == rhs.current && lhs.index == rhs.index;
+    }
+    friend bool operator!=(const Iterator& lhs, const Iterator& rhs) {
+        return !(lhs==rhs);
+    }
+};
+
+// owns a key taken out of a set
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+class ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Node_handle {
+    friend class ADS_set;
+    key_type key;
+    bool engaged;
+    Allocator alloc;
+    
+    Node_handle(key_type&& _key, const Allocator& _alloc) : key(std::move(_key)), engaged(true), alloc(_alloc) {}
+public:
+    using value_type = Key;
+    using allocator_type = Allocator;
+    
+    Node_handle() : key(), engaged(false), alloc() {}
+    Node_handle(Node_handle&& other) : key(std::move(other.key)), engaged(other.engaged), alloc(other.alloc) {
+        other.engaged = false;
+    }
+    Node_handle& operator=(Node_handle&& other) {
+        key = std::move(other.key);
+        engaged = other.engaged;
+        alloc = other.alloc;
+        other.engaged = false;
+        return *this;
+    }
+    
+    bool empty() const {
+        return !engaged;
+    }
+    explicit operator bool() const {
+        return engaged;
+    }
+    value_type& value() {
+        return key;
+    }
+    const value_type& value() const {
+        return key;
+    }
+    allocator_type get_allocator() const {
+        return alloc;
+    }
+    void swap(Node_handle& other) {
+        using std::swap;
+        swap(key, other.key);
+        swap(engaged, other.engaged);
+        swap(alloc, other.alloc);
+    }
+};
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+struct ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Insert_return {
+    iterator position;
+    bool inserted;
+    node_type node;
+};
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN> void swap(ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>& lhs, ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>& rhs) { lhs.swap(rhs); }
 
 // #pragma mark - implemantation
 
 //#pragma Public ADS_set methods
 
-template <typename Key, size_t N>
-ADS_set<Key,N>::ADS_set() {
-    root = new Node();
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::ADS_set(): ADS_set(Allocator()) {}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::ADS_set(const Allocator& alloc): ADS_set(Compare(), alloc) {}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::ADS_set(const Compare& comp, const Allocator& alloc): leaf_pool(alloc), internal_pool(alloc), compare(comp) {
     element_counter = 0;
     depth = 0;
-    root->leaf = 1;
+    fill_factor = 1.0;
+    root = new_leaf();
 }
-template <typename Key, size_t N>
-ADS_set<Key,N>::ADS_set(std::initializer_list<key_type> ilist): ADS_set{} {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::ADS_set(std::initializer_list<key_type> ilist, const Allocator& alloc): ADS_set{alloc} {
     insert(ilist);
 }
-template <typename Key, size_t N>
-template<typename InputIt> ADS_set<Key,N>::ADS_set(InputIt first, InputIt last): ADS_set() {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::ADS_set(std::initializer_list<key_type> ilist, const Compare& comp, const Allocator& alloc): ADS_set(comp, alloc) {
+    insert(ilist);
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template<typename InputIt> ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::ADS_set(InputIt first, InputIt last, const Allocator& alloc): ADS_set(alloc) {
     
     insert(first,last);
 }
-template <typename Key, size_t N>
-ADS_set<Key,N>::ADS_set(const ADS_set& other) {
-    root = new Node();
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template<typename InputIt> ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::ADS_set(InputIt first, InputIt last, const Compare& comp, const Allocator& alloc): ADS_set(comp, alloc) {
+    insert(first,last);
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::ADS_set(const ADS_set& other): ADS_set(other.compare, std::allocator_traits<Allocator>::select_on_container_copy_construction(other.get_allocator())) {
+    fill_factor = other.fill_factor;
+    clone_from(other);
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::ADS_set(ADS_set&& other) noexcept: leaf_pool(other.get_allocator()), internal_pool(other.get_allocator()), compare(other.compare) {
+    // we start without a root, other is left that way
+    root = nullptr;
+    element_counter = 0;
     depth = 0;
-    insert(other.begin(), other.end());
-    element_counter = other.element_counter;
+    fill_factor = 1.0;
+    swap(other);
 }
-template <typename Key, size_t N>
-ADS_set<Key,N>::~ADS_set(){
-    if (root) {
-        delete root;
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::~ADS_set(){
+    destroy_all();
+    
+    // the snapshots still alive get the pools, the last one frees them
+    if (snapshots) {
+        std::lock_guard<std::mutex> guard(snapshots->lock);
+        snapshots->leaf_pool.swap(leaf_pool);
+        snapshots->internal_pool.swap(internal_pool);
+        snapshots->orphaned = true;
+        for (Node *released : snapshots->released) {
+            destroy(released, snapshots->leaf_pool, snapshots->internal_pool);
+        }
+        snapshots->outstanding -= snapshots->released.size();
+        snapshots->released.clear();
     }
 }
 
-template <typename Key, size_t N>
-ADS_set<Key,N>& ADS_set<Key,N>::operator=(const ADS_set& other) {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>& ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::operator=(const ADS_set& other) {
     if (this == &other) {return *this;}
-    clear();
     
-    insert(other.begin(), other.end());
-    element_counter = other.element_counter;
+    // built next to the old tree, so a failing copy leaves us as we were
+    ADS_set copy(other.compare, get_allocator());
+    copy.clone_from(other);
+    copy.fill_factor = fill_factor;
+    swap(copy);
     return *this;
 }
-template <typename Key, size_t N>
-ADS_set<Key,N>& ADS_set<Key,N>::operator=(std::initializer_list<key_type> ilist) {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>& ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::operator=(ADS_set&& other) noexcept(std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value || std::allocator_traits<Allocator>::is_always_equal::value) {
+    if (this == &other) {return *this;}
+    move_assign(other, typename std::allocator_traits<Allocator>::propagate_on_container_move_assignment());
+    return *this;
+}
+
+// other is left without a root, snapshots of either side go along with their nodes.
+// the allocators go along with the slabs they handed out
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::move_assign(ADS_set& other, std::true_type) {
+    using std::swap;
+    clear();
+    swap_trees(other, std::true_type());
+    swap(fill_factor,other.fill_factor);
+    swap(compare,other.compare);
+}
+// our allocator stays. an equal one can free the slabs of other, otherwise the
+// keys come over into our own pools
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::move_assign(ADS_set& other, std::false_type) {
+    if (get_allocator() == other.get_allocator()) {
+        clear();
+        swap(other);
+        return;
+    }
+    other.collect_snapshots();
+    bool shared = other.snapshots && other.snapshots->outstanding;
+    std::vector<key_type> keys;
+    keys.reserve(other.element_counter);
+    for (Cursor there = first_key(other.top()); there.leaf; advance(there)) {
+        key_type& key = there.leaf->keys[there.index];
+        if (shared) {
+            keys.push_back(key);
+        } else {
+            keys.push_back(std::move(key));
+        }
+    }
+    fill_factor = other.fill_factor;
+    bulk_load(keys);
+    compare = other.compare;
+    other.clear();
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>& ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::operator=(std::initializer_list<key_type> ilist) {
     clear();
     insert(ilist);
     return *this;
     
 }
 
-template <typename Key, size_t N>
-typename ADS_set<Key,N>::size_type ADS_set<Key,N>::size() const {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::size_type ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::size() const {
     return element_counter;
 }
-template <typename Key, size_t N>
-bool ADS_set<Key,N>::empty() const {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+bool ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::empty() const {
     return element_counter == 0;
 }
 
-template <typename Key, size_t N>
-size_t ADS_set<Key,N>::count(const_reference key) const {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+size_t ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::count(const_reference key) const {
     
-    Node* current = find_leaf(root, key);
+    LeafNode* current = find_leaf(top(), key, compare);
     
-    auto pair = binary_search_in_node(current, 0, current->keys_counter-1, key);
+    auto pair = search_in_node(current, key, compare);
     
     if (pair.second) {
         return true;
@@ -274,12 +976,12 @@ size_t ADS_set<Key,N>::count(const_reference key) const {
     return false;
 }
 
-template <typename Key, size_t N>
-typename ADS_set<Key,N>::iterator ADS_set<Key,N>::find(const key_type& key) const {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::iterator ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::find(const key_type& key) const {
     
-    Node *current = find_leaf(root, key);
+    LeafNode *current = find_leaf(top(), key, compare);
     
-    auto pair = binary_search_in_node(current, 0, current->keys_counter-1, key);
+    auto pair = search_in_node(current, key, compare);
     
     if (pair.second) {
         return Iterator(current, pair.first);
@@ -287,57 +989,405 @@ typename ADS_set<Key,N>::iterator ADS_set<Key,N>::find(const key_type& key) cons
     return end();
 }
 
-template <typename Key, size_t N>
-void ADS_set<Key,N>::clear() {
-    delete root;
-    root = new Node();
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::size_type ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::count_many(const key_type* keys, size_type n, std::vector<bool>& found) const {
+    size_type hits = 0;
+    found.assign(n, false);
+    
+    find_leaf_many(keys, n, [&] (size_type i, LeafNode* current) {
+        if (search_in_node(current, keys[i], compare).second) {
+            found[i] = true;
+            ++hits;
+        }
+    });
+    return hits;
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::find_many(const key_type* keys, size_type n, iterator* result) const {
+    iterator last = end();
+    
+    find_leaf_many(keys, n, [&] (size_type i, LeafNode* current) {
+        auto pair = search_in_node(current, keys[i], compare);
+        result[i] = pair.second ? Iterator(current, pair.first) : last;
+    });
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::iterator ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::lower_bound(const key_type& key) const {
+    LeafNode *current = find_leaf(top(), key, compare);
+    unsigned index = search::lower(current->keys, current->keys_counter, key, compare);
+    
+    // everything in this leaf is smaller, so it is the first key of the next one
+    if (index == current->keys_counter && current->next) {
+        return Iterator(current->next, 0);
+    }
+    return Iterator(current, index);
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::iterator ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::upper_bound(const key_type& key) const {
+    LeafNode *current = find_leaf(top(), key, compare);
+    unsigned index = search::upper(current->keys, current->keys_counter, key, compare);
+    
+    if (index == current->keys_counter && current->next) {
+        return Iterator(current->next, 0);
+    }
+    return Iterator(current, index);
+}
+
+// the heterogeneous lookups descend the same way, key only meets the comparator
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <typename K, typename C, typename>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::size_type ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::count(const K& key) const {
+    return search_in_node(find_leaf(top(), key, compare), key, compare).second;
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <typename K, typename C, typename>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::iterator ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::find(const K& key) const {
+    LeafNode *current = find_leaf(top(), key, compare);
+    auto pair = search_in_node(current, key, compare);
+    return pair.second ? Iterator(current, pair.first) : end();
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <typename K, typename C, typename>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::iterator ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::lower_bound(const K& key) const {
+    LeafNode *current = find_leaf(top(), key, compare);
+    unsigned index = search::lower(current->keys, current->keys_counter, key, compare);
+    if (index == current->keys_counter && current->next) {
+        return Iterator(current->next, 0);
+    }
+    return Iterator(current, index);
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <typename K, typename C, typename>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::iterator ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::upper_bound(const K& key) const {
+    LeafNode *current = find_leaf(top(), key, compare);
+    unsigned index = search::upper(current->keys, current->keys_counter, key, compare);
+    if (index == current->keys_counter && current->next) {
+        return Iterator(current->next, 0);
+    }
+    return Iterator(current, index);
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+std::pair<typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::iterator,typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::iterator> ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::equal_range(const key_type& key) const {
+    iterator first = lower_bound(key);
+    iterator last = first;
+    
+    if (first != end() && !compare(key, *first)) {
+        ++last;
+    }
+    return make_pair(first, last);
+}
+
+// visits every key in [lo, hi) in order. only the last key of a leaf is compared
+// against hi, the leaf with the end of the range is cut with one in-node search
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template<typename Visit> typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::size_type ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::scan(const key_type& lo, const key_type& hi, Visit visit) const {
+    size_type visited = 0;
+    if (!compare(lo, hi)) {
+        return visited;
+    }
+    
+    LeafNode *current = find_leaf(top(), lo, compare);
+    unsigned index = search::lower(current->keys, current->keys_counter, lo, compare);
+    
+    while (current) {
+        unsigned last = current->keys_counter;
+        bool done = last == 0 || !compare(current->keys[last-1], hi);
+        if (done) {
+            last = search::lower(current->keys, current->keys_counter, hi, compare);
+        }
+        
+        for (; index < last; ++index) {
+            visit(current->keys[index]);
+            ++visited;
+        }
+        if (done) {
+            break;
+        }
+        current = current->next;
+        index = 0;
+        if (current && current->next) {
+            prefetch_node(current->next);
+        }
+    }
+    return visited;
+}
+
+// keys smaller than key, every child left of the path adds its whole subtree
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::size_type ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::rank(const key_type& key) const {
+    size_type smaller = 0;
+    Node *current = top();
+    
+    while (!current->leaf) {
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        unsigned i = search::upper(internal->keys, internal->keys_counter, key, compare);
+        
+        current = internal->children[i];
+        prefetch_node(current);
+        for (unsigned j = 0; j < i; ++j) {
+            smaller += internal->counts[j];
+        }
+    }
+    LeafNode *leaf = static_cast<LeafNode*>(current);
+    return smaller + search::lower(leaf->keys, leaf->keys_counter, key, compare);
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::const_iterator ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::select(size_type k) const {
+    if (k >= element_counter) {
+        return end();
+    }
+    LeafNode *leaf = select_leaf(top(), k);
+    return Iterator(leaf, k);
+}
+
+// number of keys in [lo, hi)
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::size_type ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::count_range(const key_type& lo, const key_type& hi) const {
+    if (!compare(lo, hi)) {
+        return 0;
+    }
+    return rank(hi) - rank(lo);
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::clear() {
+    destroy_all();
     element_counter = 0;
     depth = 0;
 }
-template <typename Key, size_t N>
-void ADS_set<Key,N>::swap(ADS_set<Key, N> &other) {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::swap(ADS_set<Key,N,Allocator,Compare,LeafN,InternalN> &other) {
+    using std::swap;
+    swap_trees(other);
+    swap(fill_factor,other.fill_factor);
+    swap(compare,other.compare);
+}
+
+// the nodes and everything they live in, the comparator and fill factor stay
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <typename Propagate>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::swap_trees(ADS_set& other, Propagate propagate) {
     using std::swap;
     swap(root,other.root);
     swap(element_counter,other.element_counter);
     swap(depth,other.depth);
-    
+    leaf_pool.swap(other.leaf_pool, propagate);
+    internal_pool.swap(other.internal_pool, propagate);
+    swap(snapshots,other.snapshots);
 }
 
-template <typename Key, size_t N>
-void ADS_set<Key,N>::insert(std::initializer_list<key_type> ilist) {
-    for(auto key: ilist) {
-        insert_private_external(key);
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Node* ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::top() const {
+    return root ? root : empty_leaf();
+}
+// only ever read, every set of the type shares it
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::LeafNode* ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::empty_leaf() {
+    static LeafNode leaf;
+    return &leaf;
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::ensure_root() {
+    if (!root) {
+        root = new_leaf();
+        depth = 0;
     }
 }
-template <typename Key, size_t N>
-std::pair<typename ADS_set<Key,N>::iterator,bool> ADS_set<Key,N>::insert(const key_type& key) {
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::allocator_type ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::get_allocator() const {
+    return leaf_pool.get_allocator();
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::key_compare ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::key_comp() const {
+    return compare;
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::value_compare ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::value_comp() const {
+    return compare;
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::insert(std::initializer_list<key_type> ilist) {
+    insert(ilist.begin(), ilist.end());
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+std::pair<typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::iterator,bool> ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::insert(const key_type& key) {
     
     return insert_private_external(key);
 }
-template <typename Key, size_t N>
-template<typename InputIt> void ADS_set<Key,N>::insert(InputIt first, InputIt last) {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+std::pair<typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::iterator,bool> ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::insert(key_type&& key) {
+    return insert_private_external(std::move(key));
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template<typename... Args> std::pair<typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::iterator,bool> ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::emplace(Args&&... args) {
+    return insert_private_external(key_type(std::forward<Args>(args)...));
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template<typename InputIt> void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::insert(InputIt first, InputIt last) {
     if (first == last) {
         return;
     }
-    for_each(first, last, [&] (const_reference key){
-        
-        insert_private_external(key);
-        
-    });
+    std::vector<key_type> input(first, last);
+    
+    // small batches into a big tree are cheaper one by one
+    if (element_counter != 0 && input.size() * 8 < element_counter) {
+        for_each(input.begin(), input.end(), [&] (const_reference key){
+            
+            insert_private_external(key);
+            
+        });
+        return;
+    }
+    
+    // sorted (or sortable) input is built bottom-up
+    if (!std::is_sorted(input.begin(), input.end(), compare)) {
+        std::sort(input.begin(), input.end(), compare);
+    }
+    input.erase(std::unique(input.begin(), input.end(), [this] (const_reference a, const_reference b) {
+        return !compare(a,b);
+    }), input.end());
+    
+    if (element_counter != 0) {
+        // merge with the keys we already have, existing keys win
+        std::vector<key_type> merged;
+        merged.reserve(element_counter + input.size());
+        std::set_union(begin(), end(), input.begin(), input.end(), std::back_inserter(merged), compare);
+        input.swap(merged);
+    }
+    bulk_load(input);
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+size_t ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::erase(const key_type& key) {
+    return erase_private(key, nullptr);
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::node_type ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::extract(const key_type& key) {
+    key_type taken;
+    if (!erase_private(key, &taken)) {
+        return node_type();
+    }
+    return node_type(std::move(taken), get_allocator());
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::node_type ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::extract(const_iterator position) {
+    return extract(*position);
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::insert_return_type ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::insert(node_type&& node) {
+    if (node.empty()) {
+        return insert_return_type{end(), false, node_type()};
+    }
+    // the key is only moved from when it goes in
+    auto inserted = insert_private_external(std::move(node.key));
+    if (inserted.second) {
+        node.engaged = false;
+        return insert_return_type{inserted.first, true, node_type()};
+    }
+    return insert_return_type{inserted.first, false, std::move(node)};
 }
 
-template <typename Key, size_t N>
-size_t ADS_set<Key,N>::erase(const key_type& key) {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::merge(ADS_set& source) {
+    if (&source == this || source.empty()) {
+        return;
+    }
+    collect_snapshots();
+    source.collect_snapshots();
+    bool shared = (snapshots && snapshots->outstanding) || (source.snapshots && source.snapshots->outstanding);
+    // comparators without state order both trees alike, stateful ones may not
+    bool same_order = std::is_empty<Compare>::value;
+    
+    // the nodes of source go over with its slabs, both pools have to free them alike
+    if (same_order && !shared && get_allocator() == source.get_allocator()) {
+        if (empty()) {
+            swap_trees(source);
+            return;
+        }
+        const_iterator last = end();
+        --last;
+        if (compare(*last, *source.begin())) {
+            join_right(source);
+            return;
+        }
+        const_iterator source_last = source.end();
+        --source_last;
+        if (compare(*source_last, *begin())) {
+            swap_trees(source);
+            join_right(source);
+            return;
+        }
+    }
+    
+    // overlapping ranges: one walk over source decides which keys go and which stay.
+    // source in another order is looked up key by key, staying keeps its order
+    std::vector<key_type> moving, staying;
+    Cursor here = first_key(top());
+    for (Cursor there = first_key(source.root); there.leaf; advance(there)) {
+        key_type& key = there.leaf->keys[there.index];
+        bool present;
+        if (same_order) {
+            gallop(top(), here, key, nullptr, compare);
+            present = here.leaf && !compare(key, here.leaf->keys[here.index]);
+        } else {
+            present = count(key) != 0;
+        }
+        std::vector<key_type>& to = present ? staying : moving;
+        if (shared) {
+            to.push_back(key);
+        } else {
+            to.push_back(std::move(key));
+        }
+    }
+    source.bulk_load(staying);
+    if (!same_order) {
+        std::sort(moving.begin(), moving.end(), compare);
+    }
+    
+    if (moving.size() * 8 < element_counter) {
+        for (key_type& key : moving) {
+            insert_private_external(std::move(key));
+        }
+        return;
+    }
+    std::vector<key_type> merged;
+    merged.reserve(element_counter + moving.size());
+    std::merge(begin(), end(), std::make_move_iterator(moving.begin()), std::make_move_iterator(moving.end()), std::back_inserter(merged), compare);
+    bulk_load(merged);
+}
+
+// out gets the key moved out of the leaf, the rest of the erase works with it
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::size_type ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::erase_private(const key_type& lookup, key_type* out) {
 
-    pair<Node*,int> twin;
+    pair<InternalNode*,int> twin;
+    unsigned path[max_depth];
     
     if (!element_counter) { return 0;}
-    Node *current = find_leaf_with_twin(root, key, twin);
-    auto pair = binary_search_in_node(current, 0, current->keys_counter, key);
+    LeafNode *current = find_leaf_with_twin(root, lookup, twin, path);
+    auto pair = search_in_node(current, lookup, compare);
     
     if (!pair.second) {return 0;}
     
-    if (current->keys_counter-1>=N || root->leaf == true) {
+    // counts are fixed on the way down, steals and merges only move them around.
+    // nodes a snapshot still sees are copied first
+    collect_snapshots();
+    current = touch_path(path, -1, &twin.first);
+    if (out) {
+        *out = std::move(current->keys[pair.first]);
+    }
+    const_reference key = out ? *out : lookup;
+    
+    if (current->keys_counter-1>=leaf_n || root->leaf == true) {
         delete_element(current, pair.first);
         if (twin.first) {
             twin.first->keys[twin.second] = current->keys[0];
@@ -379,31 +1429,76 @@ size_t ADS_set<Key,N>::erase(const key_type& key) {
 }
 
 
-template <typename Key, size_t N>
-typename ADS_set<Key,N>::const_iterator ADS_set<Key,N>::begin() const {
-    Node *current = root;
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::const_iterator ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::begin() const {
+    Node *current = top();
     while (!current->leaf) {
-        current = current->children[0];
+        current = static_cast<InternalNode*>(current)->children[0];
     }
-    return Iterator(current,0);
+    return Iterator(static_cast<LeafNode*>(current),0);
 }
 
 
-template <typename Key, size_t N>
-typename ADS_set<Key,N>::const_iterator ADS_set<Key,N>::end() const {
-    Node *current = root;
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::const_iterator ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::end() const {
+    Node *current = top();
     while (!current->leaf) {
-        current = current->children[current->children_counter-1];
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        current = internal->children[internal->children_counter-1];
     }
-    return Iterator(current, current->keys_counter);
+    return Iterator(static_cast<LeafNode*>(current), current->keys_counter);
 }
 
-template <typename Key, size_t N>
-void ADS_set<Key,N>::dump(std::ostream& o) const {
-    Node *current = root;
-    while (current->leaf != 1) {
-        current = current->children[0];
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::const_reverse_iterator ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::rbegin() const {
+    return const_reverse_iterator(end());
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::const_reverse_iterator ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::rend() const {
+    return const_reverse_iterator(begin());
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::set_fill_factor(double factor) {
+    if (!(factor > 0 && factor <= 1)) {
+        throw invalid_argument("fill factor has to be in (0,1]! set_fill_factor");
+    }
+    fill_factor = factor;
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+double ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::get_fill_factor() const {
+    return fill_factor;
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Snapshot ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::snapshot() {
+    collect_snapshots();
+    if (!snapshots) {
+        snapshots = std::make_shared<Snapshot_state>(get_allocator());
+    }
+    ensure_root();
+    root->refs += 1;
+    {
+        std::lock_guard<std::mutex> guard(snapshots->lock);
+        snapshots->outstanding += 1;
+    }
+    std::shared_ptr<Snapshot_root> version(new Snapshot_root{snapshots, root, element_counter, compare});
+    return Snapshot(std::move(version));
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::frozen_type ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::freeze() const {
+    return frozen_type(begin(), end(), compare, get_allocator());
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::dump(std::ostream& o) const {
+    Node *node = top();
+    while (!node->leaf) {
+        node = static_cast<InternalNode*>(node)->children[0];
     }
+    LeafNode *current = static_cast<LeafNode*>(node);
     
     while(current->next != nullptr) {
         current->keys_printer(o);
@@ -412,68 +1507,134 @@ void ADS_set<Key,N>::dump(std::ostream& o) const {
     current->keys_printer(o);
 }
 
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::save(std::ostream& o) const {
+    static_assert(std::is_trivially_copyable<key_type>::value, "save needs trivially copyable keys");
+    
+    File_header header;
+    std::memcpy(header.magic, file_magic, sizeof(header.magic));
+    header.version = file_version;
+    header.key_size = sizeof(key_type);
+    header.count = element_counter;
+    o.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    
+    // every leaf is one block
+    Node *node = top();
+    while (!node->leaf) {
+        node = static_cast<InternalNode*>(node)->children[0];
+    }
+    for (LeafNode *current = static_cast<LeafNode*>(node); current; current = current->next) {
+        o.write(reinterpret_cast<const char*>(current->keys), current->keys_counter * sizeof(key_type));
+    }
+    if (!o) {
+        throw runtime_error("write failed! save");
+    }
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::load(std::istream& i) {
+    static_assert(std::is_trivially_copyable<key_type>::value, "load needs trivially copyable keys");
+    
+    File_header header;
+    if (!i.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        throw runtime_error("no header! load");
+    }
+    if (std::memcmp(header.magic, file_magic, sizeof(header.magic)) != 0 || header.version != file_version) {
+        throw runtime_error("not an ADS_set file! load");
+    }
+    if (header.key_size != sizeof(key_type)) {
+        throw runtime_error("key size does not match! load");
+    }
+    
+    // read in chunks, a broken count must not allocate everything up front
+    std::vector<key_type> keys;
+    const uint64_t chunk = 1 << 16;
+    for (uint64_t read = 0; read < header.count; read += chunk) {
+        size_t n = (size_t)std::min(chunk, header.count - read);
+        size_t first = keys.size();
+        keys.resize(first + n);
+        if (!i.read(reinterpret_cast<char*>(keys.data() + first), n * sizeof(key_type))) {
+            throw runtime_error("file too short! load");
+        }
+    }
+    if (std::adjacent_find(keys.begin(), keys.end(), [this] (const_reference a, const_reference b) {
+        return !compare(a, b);
+    }) != keys.end()) {
+        throw runtime_error("keys not sorted! load");
+    }
+    bulk_load(keys);
+}
+
 // #pragma mark - Private ADS_set methods
 
-template <typename Key, size_t N>
-void ADS_set<Key,N>::root_split() {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::root_split() {
     depth += 1;
     
-    value_type middle = root->keys[N];
     bool root_was_leaf = root->leaf;
     
     Node* left = root;
-    Node *new_root = new Node();
-    Node *right = new Node();
+    InternalNode *new_root = new_internal();
     
     root = new_root;
     
-    right->set_parent(root);
-    left->set_parent(root);
-    
-    root->children[root->children_counter++] = left;
-    root->children[root->children_counter++] = right;
-    
-    root->add(middle);
-    
-    // move keys to the right
-    for (size_t i = N+(!root_was_leaf); i < left->keys_counter; ++i) {
-        right->add(left->keys[i]);
-    }
-    
-    if (!root_was_leaf) {
-        for (size_t i = N+1; i < left->children_counter; ++i) {
-            left->children[i]->set_parent(right);
-            right->children[right->children_counter++] = left->children[i];
-            left->children[i] = nullptr;
-        }
-        left->children_counter -= N+1;
-    }
-    
-    left->keys_counter -= N+1;
+    left->set_parent(new_root);
+    new_root->children[new_root->children_counter++] = left;
     
-    root->set_leaf(false);
-    root->set_next(nullptr);
-    // if root was leaf, then making children leaf and setting for left child's "next" pointer to the right child
     if (root_was_leaf) {
-        left->set_leaf(true);
-        left->set_next(right);
+        LeafNode *left_leaf = static_cast<LeafNode*>(left);
+        LeafNode *right = new_leaf();
+        
+        right->set_parent(new_root);
+        new_root->children[new_root->children_counter++] = right;
+        new_root->add(separator::shorten(left_leaf->keys[leaf_n-1], left_leaf->keys[leaf_n]), compare);
+        
+        // move keys to the right
+        for (size_t i = leaf_n; i < left_leaf->keys_counter; ++i) {
+            right->keys[right->keys_counter++] = std::move(left_leaf->keys[i]);
+        }
+        left_leaf->keys_counter -= leaf_n+1;
+        
+        // if root was leaf, then setting for left child's "next" pointer to the right child
+        left_leaf->set_next(right);
         right->set_next(nullptr);
+        right->set_prev(left_leaf);
     } else {
-        // else right is no leaf
-        right->set_leaf(false);
+        InternalNode *left_internal = static_cast<InternalNode*>(left);
+        InternalNode *right = new_internal();
+        
+        right->set_parent(new_root);
+        new_root->children[new_root->children_counter++] = right;
+        new_root->add(std::move(left_internal->keys[internal_n]), compare);
+        
+        // move keys to the right
+        for (size_t i = internal_n+1; i < left_internal->keys_counter; ++i) {
+            right->keys[right->keys_counter++] = std::move(left_internal->keys[i]);
+        }
+        left_internal->keys_counter -= internal_n+1;
+        
+        for (size_t i = internal_n+1; i < left_internal->children_counter; ++i) {
+            left_internal->children[i]->set_parent(right);
+            right->children[right->children_counter++] = left_internal->children[i];
+            left_internal->children[i] = nullptr;
+        }
+        left_internal->children_counter -= internal_n+1;
+        for (size_t i = 0; i < right->children_counter; ++i) {
+            right->counts[i] = left_internal->counts[internal_n+1+i];
+        }
     }
-    
+    new_root->counts[0] = subtree_size(left);
+    new_root->counts[1] = subtree_size(new_root->children[1]);
 }
-template <typename Key, size_t N>
-void ADS_set<Key,N>::internal_split(Node* left) {
-    value_type middle = left->keys[N];
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::internal_split(InternalNode* left) {
+    value_type middle = std::move(left->keys[internal_n]);
     size_t counter = 0;
-    Node *parent = left->parent;
-    Node *right = new Node();
+    InternalNode *parent = left->parent;
+    InternalNode *right = new_internal();
     
     right->set_parent(parent);
-    right->set_leaf(false);
-    parent->add(middle);
+    parent->add(std::move(middle), compare);
     
     for (size_t i = 0; i < parent->children_counter; ++i) {
         if (left == parent->children[i]) {
@@ -485,6 +1646,7 @@ void ADS_set<Key,N>::internal_split(Node* left) {
     if (counter < parent->children_counter-1) {
         for (size_t i = parent->children_counter-1; i > counter; --i) {
             parent->children[i+1] = parent->children[i];
+            parent->counts[i+1] = parent->counts[i];
         }
         parent->children[counter+1] = right;
         parent->children_counter+=1;
@@ -493,17 +1655,20 @@ void ADS_set<Key,N>::internal_split(Node* left) {
     }
     
     // move keys to the right
-    for (size_t i = N+1; i < left->keys_counter; ++i) {
-        right->add(left->keys[i]);
+    for (size_t i = internal_n+1; i < left->keys_counter; ++i) {
+        right->keys[right->keys_counter++] = std::move(left->keys[i]);
     }
-    left->keys_counter -= N+1;
+    left->keys_counter -= internal_n+1;
     // move pointers to the right
-    for (size_t i = N+1; i < left->children_counter; ++i) {
+    for (size_t i = internal_n+1; i < left->children_counter; ++i) {
         left->children[i]->set_parent(right);
+        right->counts[right->children_counter] = left->counts[i];
         right->children[right->children_counter++] = left->children[i];
         left->children[i] = nullptr;
     }
-    left->children_counter = N+1;
+    left->children_counter = internal_n+1;
+    parent->counts[counter] = subtree_size(left);
+    parent->counts[counter+1] = subtree_size(right);
     
     if (has_max_num_of_keys(parent)) {
         if (is_root(parent)) {
@@ -513,24 +1678,26 @@ void ADS_set<Key,N>::internal_split(Node* left) {
         }
     }
 }
-template <typename Key, size_t N>
-void ADS_set<Key,N>::external_split(Node* left) {
-    value_type middle = left->keys[N];
-    Node *parent = left->parent;
-    Node *right = new Node();
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::external_split(LeafNode* left) {
+    value_type middle = separator::shorten(left->keys[leaf_n-1], left->keys[leaf_n]);
+    InternalNode *parent = left->parent;
+    LeafNode *right = new_leaf();
     right->set_parent(parent);
     
     // counter for who has raised split
-    int counter = 0;
+    size_t counter = 0;
     
     // assignment of next
-    if (left->next!=nullptr) {
-        right->set_next(left->next);
+    right->set_next(left->next);
+    right->set_prev(left);
+    if (left->next) {
+        left->next->set_prev(right);
     }
     left->set_next(right);
-    parent->add(middle);
+    parent->add(std::move(middle), compare);
     // find needed index for shifting nodes
-    for (int i = 0; i < parent->children_counter; ++i) {
+    for (size_t i = 0; i < parent->children_counter; ++i) {
         if (left == parent->children[i]) {
             counter = i;
             break;
@@ -538,77 +1705,65 @@ void ADS_set<Key,N>::external_split(Node* left) {
     }
     
     // shift parent childrens
-    if (counter < parent->children_counter-1) {
-        for (int i = parent->children_counter-1; i >= counter; --i) {
-            parent->children[i+1] = parent->children[i];
-        }
-        
-        //setting next pointer
-        parent->children[counter]->set_next(right);
-        right->set_next(parent->children[counter+2]);
-        
-        parent->children[counter+1] = right;
-        parent->children_counter+=1;
-        
-    } else {
-        parent->children[parent->children_counter-1]->set_next(right);
-        parent->children[parent->children_counter++] = right;
+    for (size_t i = parent->children_counter; i > counter+1; --i) {
+        parent->children[i] = parent->children[i-1];
+        parent->counts[i] = parent->counts[i-1];
     }
+    parent->children[counter+1] = right;
+    parent->children_counter+=1;
     
     // move the keys to the right
-    for (size_t i = N; i < left->keys_counter; ++i) {
-        right->add(left->keys[i]);
+    for (size_t i = leaf_n; i < left->keys_counter; ++i) {
+        right->keys[right->keys_counter++] = std::move(left->keys[i]);
     }
-    left->keys_counter -= N+1;
+    left->keys_counter -= leaf_n+1;
+    parent->counts[counter] = left->keys_counter;
+    parent->counts[counter+1] = right->keys_counter;
     
     //check split for parent (internal split)
-    if (left->parent->keys_counter == 2*N + 1) {
-        if (left->parent->parent == nullptr) {
+    if (has_max_num_of_keys(parent)) {
+        if (is_root(parent)) {
             root_split();
         }
         else {
-            internal_split(left->parent);
+            internal_split(parent);
         }
     }
 }
 
 
-template <typename Key, size_t N>
-bool ADS_set<Key,N>::has_max_num_of_keys(Node* current) {
-    return current->keys_counter == 2*N+1;
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+bool ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::has_max_num_of_keys(Node* current) {
+    return current->keys_counter == 2*(current->leaf ? leaf_n : internal_n)+1;
 }
-template <typename Key, size_t N>
-bool ADS_set<Key,N>::is_root(Node* current) {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+bool ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::is_root(Node* current) {
     return current == root;
 }
 
-template <typename Key, size_t N>
-void  ADS_set<Key,N>::shift_left(size_t start, size_t end, Node* current) {
-    for (size_t i = start; i < end; ++i) {
-        current->keys[i] = current->keys[i+1];
-    }
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void  ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::shift_left(size_t start, size_t end, value_type* keys) {
+    std::move(keys + start + 1, keys + end + 1, keys + start);
 }
-template <typename Key, size_t N>
-void  ADS_set<Key,N>::shift_right(size_t start, size_t end, Node* current) {
-    for (size_t i = end; i > start; --i) {
-        current->keys[i] = current->keys[i-1];
-    }
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void  ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::shift_right(size_t start, size_t end, value_type* keys) {
+    std::move_backward(keys + start, keys + end, keys + end + 1);
 }
 
-template <typename Key, size_t N>
-bool  ADS_set<Key,N>::equal(const key_type& key, const key_type& to) {
-    if (!key_compare()(key,to) && !key_compare()(to,key)) {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+bool  ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::equal(const key_type& key, const key_type& to) {
+    if (!compare(key,to) && !compare(to,key)) {
         return true;
     }
     return false;
 }
 
-template <typename Key, size_t N>
-size_t ADS_set<Key,N>::index_from_parent(Node* current) {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+size_t ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::index_from_parent(Node* current) {
     if (current == root) {
         throw runtime_error("root! index_from_parent");
     } else {
-        Node *parent = current->parent;
+        InternalNode *parent = current->parent;
         
         for (size_t i = 0; i < parent->children_counter; ++i) {
             if (parent->children[i] == current) {
@@ -619,52 +1774,63 @@ size_t ADS_set<Key,N>::index_from_parent(Node* current) {
     throw runtime_error("no current in childrens from parent! index_from_parent");
 }
 
-template <typename Key, size_t N>
-bool ADS_set<Key,N>::steal_from_right(Node *current, size_t index, std::pair<Node*, size_t> twin) {
-    Node *right = current->parent->children[index+1];
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+bool ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::steal_from_right(Node *current, size_t index, std::pair<InternalNode*, size_t> twin) {
+    InternalNode *parent = current->parent;
     
     // check if we just merge or we make marge and then split
-    size_t common_size = current->keys_counter + right->keys_counter;
-    if (common_size < 2*N) { return false; }
+    size_t common_size = current->keys_counter + parent->children[index+1]->keys_counter;
+    if (common_size < 2*(current->leaf ? leaf_n : internal_n)) { return false; }
+    unshare(parent->children[index+1], index+1);
     
     if (current->leaf) {
+        LeafNode *leaf = static_cast<LeafNode*>(current);
+        LeafNode *right = static_cast<LeafNode*>(parent->children[index+1]);
         
         // move first right key
-        current->keys[current->keys_counter++] = right->keys[0];
+        leaf->keys[leaf->keys_counter++] = right->keys[0];
         
         // move all keys to the left
-        shift_left(0, right->keys_counter-1, right);
+        shift_left(0, right->keys_counter-1, right->keys);
         right->keys_counter -= 1;
         
         // change first key in parent from first in right
-        current->parent->keys[index_from_parent(right)-1] = right->keys[0];
+        parent->keys[index_from_parent(right)-1] = separator::shorten(leaf->keys[leaf->keys_counter-1], right->keys[0]);
+        parent->counts[index] += 1;
+        parent->counts[index+1] -= 1;
         
         if (twin.first) {
-            twin.first->keys[twin.second] = current->keys[0];
+            twin.first->keys[twin.second] = leaf->keys[0];
         }
         
         return true;
         
     } else { // internal node
-        Node* parent = current->parent;
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        InternalNode *right = static_cast<InternalNode*>(parent->children[index+1]);
         
         // put parent's key in the left
-        current->keys[current->keys_counter++] = parent->keys[index_from_parent(current)];
+        internal->keys[internal->keys_counter++] = parent->keys[index_from_parent(internal)];
         
         // moving childrens from the right to the left
-        current->children[current->children_counter++] = right->children[0];
+        size_type moved = right->counts[0];
+        internal->counts[internal->children_counter] = moved;
+        internal->children[internal->children_counter++] = right->children[0];
+        parent->counts[index] += moved;
+        parent->counts[index+1] -= moved;
         
-        right->children[0]->parent = current;
+        right->children[0]->parent = internal;
         
         // moving pointers to the left
-        for (size_t i = 0; i < right->children_counter; ++i) {
+        for (size_t i = 0; i+1 < right->children_counter; ++i) {
             right->children[i] = right->children[i+1];
+            right->counts[i] = right->counts[i+1];
         }
         right->children_counter -= 1;
         
         // moving key from the right to the parent and making shift in the left
         parent->keys[index_from_parent(right)-1] = right->keys[0];
-        shift_left(0, right->keys_counter-1, right);
+        shift_left(0, right->keys_counter-1, right->keys);
         right->keys_counter -= 1;
         
         return true;
@@ -673,50 +1839,65 @@ bool ADS_set<Key,N>::steal_from_right(Node *current, size_t index, std::pair<Nod
     
     return false;
 }
-template <typename Key, size_t N>
-bool ADS_set<Key,N>::steal_from_left(Node *current, size_t index, std::pair<Node*, size_t> twin) {
-    Node *left = current->parent->children[index-1];
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+bool ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::steal_from_left(Node *current, size_t index, std::pair<InternalNode*, size_t> twin) {
+    InternalNode *parent = current->parent;
     
     // check if we just merge or we make marge and then split
-    size_t common_size = current->keys_counter + left->keys_counter;
-    if (common_size < 2*N) {return false;}
-    
-    // make place for new element
-    shift_right(0, current->keys_counter, current);
-    current->keys_counter += 1;
+    size_t common_size = current->keys_counter + parent->children[index-1]->keys_counter;
+    if (common_size < 2*(current->leaf ? leaf_n : internal_n)) {return false;}
+    unshare(parent->children[index-1], index-1);
     
     if (current->leaf) {
+        LeafNode *leaf = static_cast<LeafNode*>(current);
+        LeafNode *left = static_cast<LeafNode*>(parent->children[index-1]);
+        
+        // make place for new element
+        shift_right(0, leaf->keys_counter, leaf->keys);
+        leaf->keys_counter += 1;
         
         // move elements from left to the right
-        current->keys[0] = left->keys[left->keys_counter-1];
+        leaf->keys[0] = left->keys[left->keys_counter-1];
         left->keys_counter -= 1;
         
         // change first key in parent from first in right
-        current->parent->keys[index_from_parent(current)-1] = current->keys[0];
+        parent->keys[index_from_parent(leaf)-1] = separator::shorten(left->keys[left->keys_counter-1], leaf->keys[0]);
+        parent->counts[index] += 1;
+        parent->counts[index-1] -= 1;
         
         if (twin.first) {
-            twin.first->keys[twin.second] = current->keys[0];
+            twin.first->keys[twin.second] = leaf->keys[0];
         }
         
         return true;
         
     } else {
-        Node *parent = current->parent;
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        InternalNode *left = static_cast<InternalNode*>(parent->children[index-1]);
         
-        current->keys[0] = parent->keys[index-1];
+        // make place for new element
+        shift_right(0, internal->keys_counter, internal->keys);
+        internal->keys_counter += 1;
+        
+        internal->keys[0] = parent->keys[index-1];
         
         parent->keys[index-1] = left->keys[left->keys_counter-1];
         left->keys_counter -= 1;
         
         // move all pointers to the right on 1 step
-        for (int i = current->children_counter-1; i >= 0; --i) {
-            current->children[i+1] = current->children[i];
+        for (size_t i = internal->children_counter; i > 0; --i) {
+            internal->children[i] = internal->children[i-1];
+            internal->counts[i] = internal->counts[i-1];
         }
-        current->children_counter += 1;
+        internal->children_counter += 1;
         
         // move the children from left to the right
-        current->children[0] = left->children[left->children_counter-1];
-        left->children[left->children_counter-1]->parent = current;
+        size_type moved = left->counts[left->children_counter-1];
+        internal->counts[0] = moved;
+        parent->counts[index] += moved;
+        parent->counts[index-1] -= moved;
+        internal->children[0] = left->children[left->children_counter-1];
+        left->children[left->children_counter-1]->parent = internal;
         
         left->children_counter -= 1;
         
@@ -725,84 +1906,93 @@ bool ADS_set<Key,N>::steal_from_left(Node *current, size_t index, std::pair<Node
     
     return false;
 }
-template <typename Key, size_t N>
-bool ADS_set<Key,N>::merge_with_left(Node *current, size_t index, const_reference key, std::pair<Node*, size_t> twin) {
-    Node *left = current->parent->children[index-1];
-    Node *parent = current->parent;
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+bool ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::merge_with_left(Node *current, size_t index, const_reference key, std::pair<InternalNode*, size_t> twin) {
+    InternalNode *parent = current->parent;
     
     if (parent == root && parent->keys_counter == 1) {
         merge_root();
         return true;
     }
+    unshare(parent->children[index-1], index-1);
     
     if (current->leaf) {
+        LeafNode *leaf = static_cast<LeafNode*>(current);
+        LeafNode *left = static_cast<LeafNode*>(parent->children[index-1]);
         
         // moving keys from the left to the right
-        for (size_t i = 0; i < current->keys_counter; ++i) {
-            left->keys[left->keys_counter++] = current->keys[i];
+        for (size_t i = 0; i < leaf->keys_counter; ++i) {
+            left->keys[left->keys_counter++] = leaf->keys[i];
         }
-        current->keys_counter = 0;
         
         // setting new next for the left, becouse right merging with him
-        left->next = current->next;
+        left->next = leaf->next;
+        if (leaf->next) {
+            leaf->next->prev = left;
+        }
         
         if (twin.first) {
             key_type& twin_key = twin.first->keys[twin.second];
             
-            if (!key_compare()(key,twin_key) && !key_compare()(twin_key,key)) {
+            if (!compare(key,twin_key) && !compare(twin_key,key)) {
                 
-                twin.first->keys[twin.second] = current->keys[0];
+                twin.first->keys[twin.second] = leaf->keys[0];
             }
         }
+        leaf->keys_counter = 0;
         
         // shifting parent's keys to the left
-        shift_left(index-1, parent->keys_counter, parent);
+        shift_left(index-1, parent->keys_counter, parent->keys);
         parent->keys_counter -= 1;
         
-        delete parent->children[index];
+        destroy(parent->children[index]);
+        parent->counts[index-1] += parent->counts[index];
         
         // shifting parent's childrens to the left
-        for (size_t i = index; i < parent->children_counter; ++i) {
+        for (size_t i = index; i+1 < parent->children_counter; ++i) {
             parent->children[i] = parent->children[i+1];
+            parent->counts[i] = parent->counts[i+1];
         }
         parent->children_counter -= 1;
         
     } else { // internal node
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        InternalNode *left = static_cast<InternalNode*>(parent->children[index-1]);
         
         // get down parent's key
         left->keys[left->keys_counter++] = parent->keys[index-1];
         
         // shifting parent's keys
-        shift_left(index-1, parent->keys_counter-1, parent);
+        shift_left(index-1, parent->keys_counter-1, parent->keys);
         parent->keys_counter -= 1;
         
         // moving keys from the right to the left
-        for (size_t i = 0; i < current->keys_counter; ++i) {
-            left->keys[left->keys_counter++] = current->keys[i];
+        for (size_t i = 0; i < internal->keys_counter; ++i) {
+            left->keys[left->keys_counter++] = internal->keys[i];
         }
-        current->keys_counter = 0;
+        internal->keys_counter = 0;
         
         // moving kids from the right to the left
-        for (size_t i = 0; i < current->children_counter; ++i) {
-            left->children[left->children_counter++] = current->children[i];
-            current->children[i]->parent = left;
+        for (size_t i = 0; i < internal->children_counter; ++i) {
+            left->counts[left->children_counter] = internal->counts[i];
+            left->children[left->children_counter++] = internal->children[i];
+            internal->children[i]->parent = left;
         }
+        parent->counts[index-1] += parent->counts[index];
         
         // moving pointers
-        for (size_t i = index; i < parent->children_counter; ++i) {
+        for (size_t i = index; i+1 < parent->children_counter; ++i) {
             parent->children[i] = parent->children[i+1];
+            parent->counts[i] = parent->counts[i+1];
         }
         parent->children_counter -= 1;
         
-        for (size_t i = 0; i < 2*N + 1; ++i) {
-            current->children[i] = nullptr;
-        }
-        current->children_counter = 0;
+        internal->children_counter = 0;
         
-        delete current;
+        destroy(internal);
     }
     
-    if (parent->keys_counter < N && parent != root) {
+    if (parent->keys_counter < internal_n && parent != root) {
         
         size_t index_parent = index_from_parent(parent);
         size_t max_parent_index = parent->parent->children_counter-1;
@@ -827,95 +2017,108 @@ bool ADS_set<Key,N>::merge_with_left(Node *current, size_t index, const_referenc
     
     return false;
 }
-template <typename Key, size_t N>
-bool ADS_set<Key,N>::merge_with_right(Node *current, size_t index, const_reference key, std::pair<Node*, size_t> twin) {
-    Node *right = current->parent->children[index+1];
-    Node *parent = current->parent;
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+bool ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::merge_with_right(Node *current, size_t index, const_reference key, std::pair<InternalNode*, size_t> twin) {
+    InternalNode *parent = current->parent;
     
     
     if (parent == root && parent->keys_counter == 1) {
         merge_root();
         return true;
     }
+    unshare(parent->children[index+1], index+1);
     
     if (current->leaf) {
+        LeafNode *leaf = static_cast<LeafNode*>(current);
+        LeafNode *right = static_cast<LeafNode*>(parent->children[index+1]);
         
         // move elements from the right to the left
         for (size_t i = 0; i < right->keys_counter; ++i) {
-            current->keys[current->keys_counter++] = right->keys[i];
+            leaf->keys[leaf->keys_counter++] = right->keys[i];
         }
         right->keys_counter = 0;
         
         // set new next
-        if (current->leaf) {
-            current->next = right->next;
+        leaf->next = right->next;
+        if (right->next) {
+            right->next->prev = leaf;
         }
         
         // shift keys in parents
-        shift_left(index, parent->keys_counter-1, parent);
+        shift_left(index, parent->keys_counter-1, parent->keys);
         parent->keys_counter -= 1;
         
+        parent->counts[index] += parent->counts[index+1];
+        
         // shift pointers in parent to the left
-        for (size_t i = index_from_parent(right); i < parent->children_counter; ++i) {
+        for (size_t i = index_from_parent(right); i+1 < parent->children_counter; ++i) {
             parent->children[i] = parent->children[i+1];
+            parent->counts[i] = parent->counts[i+1];
         }
         parent->children_counter -= 1;
         
         if (twin.first) {
-            twin.first->keys[twin.second] = current->keys[0];
+            twin.first->keys[twin.second] = leaf->keys[0];
         }
         twin.first = nullptr;
         
-        delete right;
+        destroy(right);
         
     } else {
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        InternalNode *right = static_cast<InternalNode*>(parent->children[index+1]);
         
         // making empty space in the right for left's and parent's keys
-        size_t common = current->keys_counter + 1;
-        for (int i = right->keys_counter-1; i >= 0; --i) {
-            right->keys[i+common] = right->keys[i];
+        size_t common = internal->keys_counter + 1;
+        for (size_t i = right->keys_counter; i > 0; --i) {
+            right->keys[i-1+common] = right->keys[i-1];
         }
         right->keys_counter += common;
         
         // making empty space in the right for left's childrens
-        for (int i = right->children_counter-1; i >= 0; --i) {
+        for (size_t i = right->children_counter; i > 0; --i) {
             
-            right->children[i+common] = right->children[i];
+            right->children[i-1+common] = right->children[i-1];
+            right->counts[i-1+common] = right->counts[i-1];
         }
         right->children_counter += common;
         
         // moving keys from the left to the rigth
-        for (size_t i = 0; i < current->keys_counter; ++i) {
-            right->keys[i] = current->keys[i];
+        for (size_t i = 0; i < internal->keys_counter; ++i) {
+            right->keys[i] = internal->keys[i];
         }
         
         // getting there first key of parent
-        right->keys[current->keys_counter] = parent->keys[0];
+        right->keys[internal->keys_counter] = parent->keys[0];
         
         // shifting parent's key to the left
-        shift_left(0, parent->keys_counter-1, parent);
+        shift_left(0, parent->keys_counter-1, parent->keys);
         parent->keys_counter -= 1;
-        current->keys_counter = 0;
+        internal->keys_counter = 0;
         
         // shifting parent's childrens to the left
-        for (size_t i = 0; i < parent->children_counter; ++i) {
+        parent->counts[index+1] += parent->counts[index];
+        for (size_t i = 0; i+1 < parent->children_counter; ++i) {
             parent->children[i] = parent->children[i+1];
+            parent->counts[i] = parent->counts[i+1];
         }
         parent->children_counter -= 1;
         
         // now moving pointers from the left to the right and nullptr pointers in the left
-        for (size_t i = 0; i < current->children_counter; ++i) {
-            right->children[i] = current->children[i];
-            current->children[i]->parent = right;
+        for (size_t i = 0; i < internal->children_counter; ++i) {
+            right->counts[i] = internal->counts[i];
+            right->children[i] = internal->children[i];
+            internal->children[i]->parent = right;
             
-            current->children[i] = nullptr;
+            internal->children[i] = nullptr;
         }
+        internal->children_counter = 0;
         
-        delete current;
+        destroy(internal);
     }
     
     
-    if (parent->keys_counter < N && parent != root) {
+    if (parent->keys_counter < internal_n && parent != root) {
         
         size_t index_parent = index_from_parent(parent);
         size_t max_parent_index = parent->parent->children_counter-1;
@@ -941,43 +2144,51 @@ bool ADS_set<Key,N>::merge_with_right(Node *current, size_t index, const_referen
     return false;
     
 }
-template <typename Key, size_t N>
-void ADS_set<Key,N>::merge_root() {
-    
-    Node *parent = root;
-    Node *left = parent->children[0];
-    Node *right = parent->children[1];
-    
-    if (right->leaf) {
-        parent->keys_counter -=1 ;
-    }
-    
-    // makeing empty space for left's keys
-    for (int i = parent->keys_counter; i >= 0; --i) {
-        parent->keys[i+left->keys_counter] = parent->keys[i];
-    }
-    parent->keys_counter += left->keys_counter;
-    
-    // moving keys from the left to the up
-    for (size_t i = 0; i < left->keys_counter; ++i) {
-        parent->keys[i] = left->keys[i];
-    }
-    // moving keys from the right to the up
-    for (size_t i = 0; i < right->keys_counter; ++i) {
-        parent->keys[parent->keys_counter++] = right->keys[i];
-    }
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::merge_root() {
     
-    // nullptr for old childrens
-    for (size_t i = 0; i < 2*N+1; ++i) {
-        parent->children[i] = nullptr;
-    }
-    parent->children_counter = 0;
+    InternalNode *parent = static_cast<InternalNode*>(root);
+    unshare(parent->children[0], 0);
+    unshare(parent->children[1], 1);
     
-    if (!left->leaf) {
+    if (parent->children[0]->leaf) {
+        LeafNode *left = static_cast<LeafNode*>(parent->children[0]);
+        LeafNode *right = static_cast<LeafNode*>(parent->children[1]);
+        
+        // the left leaf takes the keys from the right and becomes the root
+        for (size_t i = 0; i < right->keys_counter; ++i) {
+            left->keys[left->keys_counter++] = right->keys[i];
+        }
+        left->set_parent(nullptr);
+        left->set_next(nullptr);
+        left->set_prev(nullptr);
+        root = left;
+        
+        destroy(right);
+    } else {
+        InternalNode *left = static_cast<InternalNode*>(parent->children[0]);
+        InternalNode *right = static_cast<InternalNode*>(parent->children[1]);
+        
+        // makeing empty space for left's keys
+        for (size_t i = parent->keys_counter; i > 0; --i) {
+            parent->keys[i-1+left->keys_counter] = parent->keys[i-1];
+        }
+        parent->keys_counter += left->keys_counter;
+        
+        // moving keys from the left to the up
+        for (size_t i = 0; i < left->keys_counter; ++i) {
+            parent->keys[i] = left->keys[i];
+        }
+        // moving keys from the right to the up
+        for (size_t i = 0; i < right->keys_counter; ++i) {
+            parent->keys[parent->keys_counter++] = right->keys[i];
+        }
+        parent->children_counter = 0;
         
         // moving childrens from the left
         for (size_t i = 0; i < left->children_counter; ++i) {
             
+            parent->counts[parent->children_counter] = left->counts[i];
             parent->children[parent->children_counter++] = left->children[i];
             left->children[i]->parent = parent;
         }
@@ -985,29 +2196,157 @@ void ADS_set<Key,N>::merge_root() {
         // moving childrens from the right
         for (size_t i = 0; i < right->children_counter; ++i) {
             
+            parent->counts[parent->children_counter] = right->counts[i];
             parent->children[parent->children_counter++] = right->children[i];
             right->children[i]->parent = parent;
         }
         
-        for (size_t i = 0; i < 2*N+1; ++i) {
-            left->children[i] = nullptr;
-            right->children[i] = nullptr;
-        }
+        left->children_counter = 0;
+        right->children_counter = 0;
+        destroy(left);
+        destroy(right);
+        parent = nullptr;
     }
     
-    delete left;
-    delete right;
-    
-    if (root->children_counter == 0) {
-        root->leaf = true;
+    // the old root is only gone if the leafs took over
+    if (parent) {
+        parent->children_counter = 0;
+        destroy(parent);
     }
     
     depth-=1;
 }
 
-template <typename Key, size_t N>
-void ADS_set<Key,N>::delete_element(Node *current, size_t index) {
-    shift_left(index, current->keys_counter-1, current);
+// a subtree hung in by a join can be short of keys, the erase rebalancing fixes it
+// from there up. it is the first or the last child of its parent. without a twin
+// the merges only pass the key on
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::fix_underfull(Node* current, const_reference key) {
+    std::pair<InternalNode*, size_t> no_twin(nullptr, 0);
+    
+    while (current != root && current->keys_counter < (current->leaf ? leaf_n : internal_n)) {
+        size_t index = index_from_parent(current);
+        
+        if (index == 0) {
+            if (!steal_from_right(current, index, no_twin)) {
+                merge_with_right(current, index, key, no_twin);
+                return;
+            }
+        } else if (!steal_from_left(current, index, no_twin)) {
+            merge_with_left(current, index, key, no_twin);
+            return;
+        }
+    }
+}
+
+// every key of source is greater than ours. the smaller tree goes whole into the
+// spine of the bigger one at its own height, so only the nodes along that spine
+// are touched. the nodes come over with the slabs they live in
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::join_right(ADS_set& source) {
+    leaf_pool.absorb(source.leaf_pool);
+    internal_pool.absorb(source.internal_pool);
+    
+    Node *other = source.root;
+    int other_depth = source.depth;
+    size_type other_size = source.element_counter;
+    size_type own_size = element_counter;
+    source.root = source.new_leaf();
+    source.element_counter = 0;
+    source.depth = 0;
+    
+    // linking the leaf chains
+    Node *current = root;
+    while (!current->leaf) {
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        current = internal->children[internal->children_counter-1];
+    }
+    LeafNode *last = static_cast<LeafNode*>(current);
+    current = other;
+    while (!current->leaf) {
+        current = static_cast<InternalNode*>(current)->children[0];
+    }
+    LeafNode *first = static_cast<LeafNode*>(current);
+    last->set_next(first);
+    first->set_prev(last);
+    element_counter += other_size;
+    key_type middle = separator::shorten(last->keys[last->keys_counter-1], first->keys[0]);
+    
+    if (depth == other_depth) {
+        Node *left = root;
+        InternalNode *new_root = new_internal();
+        new_root->keys[new_root->keys_counter++] = middle;
+        new_root->counts[0] = own_size;
+        new_root->children[new_root->children_counter++] = left;
+        new_root->counts[1] = other_size;
+        new_root->children[new_root->children_counter++] = other;
+        left->set_parent(new_root);
+        other->set_parent(new_root);
+        root = new_root;
+        depth += 1;
+        
+        // a merge of the two may already have replaced the left one
+        fix_underfull(other, middle);
+        if (!root->leaf && static_cast<InternalNode*>(root)->children[0] == left) {
+            fix_underfull(left, middle);
+        }
+    } else if (depth > other_depth) {
+        // down the right spine to the node whose children are as high as other
+        InternalNode *parent = static_cast<InternalNode*>(root);
+        for (int height = depth; height > other_depth+1; --height) {
+            parent->counts[parent->children_counter-1] += other_size;
+            parent = static_cast<InternalNode*>(parent->children[parent->children_counter-1]);
+        }
+        parent->keys[parent->keys_counter++] = middle;
+        parent->counts[parent->children_counter] = other_size;
+        parent->children[parent->children_counter++] = other;
+        other->set_parent(parent);
+        
+        if (has_max_num_of_keys(parent)) {
+            if (is_root(parent)) {
+                root_split();
+            } else {
+                internal_split(parent);
+            }
+        }
+        fix_underfull(other, middle);
+    } else {
+        // down the left spine of other, our root goes in front
+        InternalNode *parent = static_cast<InternalNode*>(other);
+        for (int height = other_depth; height > depth+1; --height) {
+            parent->counts[0] += own_size;
+            parent = static_cast<InternalNode*>(parent->children[0]);
+        }
+        shift_right(0, parent->keys_counter, parent->keys);
+        parent->keys[0] = middle;
+        parent->keys_counter += 1;
+        for (size_t i = parent->children_counter; i > 0; --i) {
+            parent->children[i] = parent->children[i-1];
+            parent->counts[i] = parent->counts[i-1];
+        }
+        parent->children_counter += 1;
+        
+        Node *left = root;
+        parent->counts[0] = own_size;
+        parent->children[0] = left;
+        left->set_parent(parent);
+        root = other;
+        depth = other_depth;
+        
+        if (has_max_num_of_keys(parent)) {
+            if (is_root(parent)) {
+                root_split();
+            } else {
+                internal_split(parent);
+            }
+        }
+        fix_underfull(left, middle);
+    }
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::delete_element(LeafNode *current, size_t index) {
+    shift_left(index, current->keys_counter-1, current->keys);
     current->keys_counter-=1;
     element_counter -= 1;
     
@@ -1020,14 +2359,124 @@ void ADS_set<Key,N>::delete_element(Node *current, size_t index) {
 //    }
 }
 
-template <typename Key, size_t N>
-void ADS_set<Key,N>::printTree() {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::LeafNode* ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::new_leaf() {
+    return new (leaf_pool.allocate()) LeafNode();
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::InternalNode* ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::new_internal() {
+    return new (internal_pool.allocate()) InternalNode();
+}
+
+// depth first, so the leafs come out of the pool in key order
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Node* ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::clone(const Node* source, InternalNode* parent, LeafNode*& last_leaf) {
+    if (source->leaf) {
+        const LeafNode* from = static_cast<const LeafNode*>(source);
+        LeafNode* leaf = new_leaf();
+        try {
+            std::copy(from->keys, from->keys + from->keys_counter, leaf->keys);
+        } catch (...) {
+            destroy(leaf);
+            throw;
+        }
+        leaf->keys_counter = from->keys_counter;
+        leaf->parent = parent;
+        leaf->prev = last_leaf;
+        if (last_leaf) {
+            last_leaf->next = leaf;
+        }
+        last_leaf = leaf;
+        return leaf;
+    }
+    const InternalNode* from = static_cast<const InternalNode*>(source);
+    InternalNode* internal = new_internal();
+    internal->parent = parent;
+    try {
+        std::copy(from->keys, from->keys + from->keys_counter, internal->keys);
+        std::copy(from->counts, from->counts + from->children_counter, internal->counts);
+        internal->keys_counter = from->keys_counter;
+        for (size_t i = 0; i < from->children_counter; ++i) {
+            internal->children[i] = clone(from->children[i], internal, last_leaf);
+            ++internal->children_counter;
+        }
+    } catch (...) {
+        destroy(internal);
+        throw;
+    }
+    return internal;
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::clone_from(const ADS_set& other) {
+    destroy_all();
+    LeafNode* last_leaf = nullptr;
+    try {
+        root = other.root ? clone(other.root, nullptr, last_leaf) : nullptr;
+    } catch (...) {
+        element_counter = 0;
+        depth = 0;
+        throw;
+    }
+    element_counter = other.element_counter;
+    depth = other.depth;
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::destroy(Node *current) {
+    destroy(current, leaf_pool, internal_pool);
+}
+
+// drops one reference, a node shared with a snapshot stays for the others
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::destroy(Node *current, Node_pool<LeafNode>& leafs, Node_pool<InternalNode>& internals) {
+    if (--current->refs != 0) {
+        return;
+    }
+    if (current->leaf) {
+        LeafNode *leaf = static_cast<LeafNode*>(current);
+        leaf->~LeafNode();
+        leafs.deallocate(leaf);
+        return;
+    }
+    InternalNode *internal = static_cast<InternalNode*>(current);
+    for (size_t i = 0; i < internal->children_counter; ++i) {
+        destroy(internal->children[i], leafs, internals);
+    }
+    internal->~InternalNode();
+    internals.deallocate(internal);
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::destroy_all() {
+    collect_snapshots();
+    
+    // the pools hold nodes of older versions too, only ours go
+    if (snapshots && snapshots->outstanding) {
+        if (root) {
+            destroy(root);
+        }
+        root = nullptr;
+        return;
+    }
+    
+    // keys without destructors need no walk, the slabs go back as a whole
+    if (root && !std::is_trivially_destructible<key_type>::value) {
+        destroy(root);
+    }
+    root = nullptr;
+    leaf_pool.release();
+    internal_pool.release();
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::printTree() {
     size_type current_depth = 0;
-    size_type nol = pow((2 * N + 1), depth); //num of leafs
+    size_type nol = pow((2 * internal_n + 1), depth); //num of leafs
     
     Node** current = new Node*[nol];
     
-    current[0] = root;
+    current[0] = top();
     size_type current_count = 1;
     
     while (current_depth <= depth) {
@@ -1042,8 +2491,12 @@ void ADS_set<Key,N>::printTree() {
         Node** temp = new Node*[nol];
         int t = 0;
         for (size_t i = 0; i < current_count; ++i) {
-            for (size_t l = 0; l < current[i]->children_counter; ++l) {
-                temp[t] = current[i]->children[l];
+            if (current[i]->leaf) {
+                continue;
+            }
+            InternalNode *internal = static_cast<InternalNode*>(current[i]);
+            for (size_t l = 0; l < internal->children_counter; ++l) {
+                temp[t] = internal->children[l];
                 ++t;
             }
         }
@@ -1058,87 +2511,318 @@ void ADS_set<Key,N>::printTree() {
         current_count = t;
         ++current_depth;
     }
+    
+    delete[] current;
 }
 
-//#pragma mark - Node methods
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+size_t ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::bulk_groups(size_t count, size_t min, size_t target) {
+    if (count <= target) {
+        return 1;
+    }
+    size_t groups = (count + target - 1) / target;
+    
+    // too many groups would leave them underfull, each needs at least min
+    if (count / groups < min) {
+        groups = count / min;
+    }
+    return groups ? groups : 1;
+}
 
-template <typename Key, size_t N>
-ADS_set<Key,N>::Node::Node() {
-    keys = new value_type[(2*N)+1];
-    children = new Node*[(2*N)+2];
-    parent = nullptr;
-    next = nullptr;
-    leaf = 1;
-    keys_counter = 0;
-    children_counter = 0;
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Cursor ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::first_key(Node* root) {
+    Node* current = root;
+    while (!current->leaf) {
+        current = static_cast<InternalNode*>(current)->children[0];
+    }
+    LeafNode* leaf = static_cast<LeafNode*>(current);
+    return Cursor{leaf->keys_counter ? leaf : nullptr, 0};
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::advance(Cursor& cursor) {
+    if (++cursor.index == cursor.leaf->keys_counter) {
+        cursor.leaf = cursor.leaf->next;
+        cursor.index = 0;
+    }
 }
 
-template <typename Key, size_t N>
-ADS_set<Key,N>::Node::~Node() {
-    delete[] keys;
-    for (size_t i = 0; i < children_counter; ++i) {
-        delete children[i];
+// moves the cursor to the first key not less than key. the keys passed are
+// appended to out, without out a long run is left by descending from the root
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::gallop(Node* root, Cursor& cursor, const_reference key, std::vector<key_type>* out, const key_compare& compare) {
+    for (unsigned hops = 0; cursor.leaf; ++hops) {
+        LeafNode* leaf = cursor.leaf;
+        unsigned n = leaf->keys_counter;
+        if (!compare(leaf->keys[n-1], key)) {
+            unsigned index = cursor.index + search::lower(leaf->keys + cursor.index, n - cursor.index, key, compare);
+            if (out) {
+                out->insert(out->end(), leaf->keys + cursor.index, leaf->keys + index);
+            }
+            cursor.index = index;
+            return;
+        }
+        if (out) {
+            out->insert(out->end(), leaf->keys + cursor.index, leaf->keys + n);
+        } else if (hops == 2) {
+            leaf = find_leaf(root, key, compare);
+            cursor.leaf = leaf;
+            cursor.index = search::lower(leaf->keys, leaf->keys_counter, key, compare);
+            if (cursor.index == leaf->keys_counter) {
+                cursor.leaf = leaf->next;
+                cursor.index = 0;
+            }
+            return;
+        }
+        cursor.leaf = leaf->next;
+        cursor.index = 0;
     }
-    delete[] children;
 }
 
-template <typename Key, size_t N>
-int ADS_set<Key,N>::Node::add(const_reference key) {
-    if (keys_counter == 0) {
-        keys[keys_counter++] = key;
-        return keys_counter-1;
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN> ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::combine(const ADS_set& lhs, const ADS_set& rhs, Algebra algebra) {
+    const key_compare& compare = lhs.compare;
+    std::vector<key_type> out;
+    out.reserve(algebra == union_of ? lhs.size() + rhs.size() : lhs.size());
+    
+    Cursor left = first_key(lhs.top()), right = first_key(rhs.top());
+    while (left.leaf && right.leaf) {
+        const_reference l = left.leaf->keys[left.index];
+        const_reference r = right.leaf->keys[right.index];
+        if (compare(l, r)) {
+            gallop(lhs.top(), left, r, algebra == intersection_of ? nullptr : &out, compare);
+        } else if (compare(r, l)) {
+            gallop(rhs.top(), right, l, algebra == union_of ? &out : nullptr, compare);
+        } else {
+            if (algebra != difference_of) {
+                out.push_back(l);
+            }
+            advance(left);
+            advance(right);
+        }
     }
     
-    if (key_compare()(key, keys[0])) {
-        for (size_t i = keys_counter; i > 0; --i) {
-            keys[i] = keys[i-1];
+    // what is left of one side is copied leaf by leaf
+    Cursor rest = algebra == intersection_of ? Cursor{nullptr, 0} : left.leaf || algebra == difference_of ? left : right;
+    for (; rest.leaf; rest = Cursor{rest.leaf->next, 0}) {
+        out.insert(out.end(), rest.leaf->keys + rest.index, rest.leaf->keys + rest.leaf->keys_counter);
+    }
+    
+    ADS_set result(lhs.compare, lhs.get_allocator());
+    result.bulk_load(out);
+    return result;
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+bool ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::includes_all(const ADS_set& lhs, const ADS_set& rhs) {
+    if (rhs.size() > lhs.size()) {
+        return false;
+    }
+    const key_compare& compare = lhs.compare;
+    Cursor left = first_key(lhs.top()), right = first_key(rhs.top());
+    while (right.leaf) {
+        if (!left.leaf) {
+            return false;
         }
-        keys[0] = key;
-        ++keys_counter;
-        return 0;
-    } else if (key_compare()(keys[keys_counter-1], key)) {
-        keys[keys_counter++] = key;
-        return keys_counter-1;
-    } else {
-        //   binary search
-        
-        unsigned start = 0;
-        unsigned end = keys_counter - 1;
-        unsigned middle = start + ((end - start) / 2);
-        
-        while(!((key_compare()(key, keys[middle + 1])) && (key_compare()(keys[middle], key)))) {
-            if(key_compare()(key, keys[middle])) {
-                end = middle;
+        const_reference l = left.leaf->keys[left.index];
+        const_reference r = right.leaf->keys[right.index];
+        if (compare(l, r)) {
+            gallop(lhs.top(), left, r, nullptr, compare);
+        } else if (compare(r, l)) {
+            return false;
+        } else {
+            advance(left);
+            advance(right);
+        }
+    }
+    return true;
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::bulk_load(std::vector<key_type>& sorted) {
+    collect_snapshots();
+    
+    // the new tree is built next to the old one, a throwing key copy or
+    // allocation frees what was built so far and leaves the set as it was
+    Node *new_root = nullptr;
+    int new_depth = 0;
+    
+    if (sorted.empty()) {
+        new_root = new_leaf();
+        if (root) {
+            destroy(root);
+        }
+        root = new_root;
+        depth = new_depth;
+        element_counter = 0;
+        return;
+    }
+    
+    // filling leafs from left to right and linking them
+    size_t target = std::max(leaf_n, std::min(2*leaf_n, (size_t)(2*leaf_n*fill_factor)));
+    size_t groups = bulk_groups(sorted.size(), leaf_n, target);
+    
+    std::vector<Node*> level;
+    std::vector<key_type> firsts; // separator in front of each node of the level
+    std::vector<size_type> sizes; // keys below each node of the level
+    std::vector<Node*> upper;
+    level.reserve(groups);
+    firsts.reserve(groups);
+    sizes.reserve(groups);
+    
+    try {
+        size_t pos = 0;
+        LeafNode *previous = nullptr;
+        for (size_t g = 0; g < groups; ++g) {
+            size_t share = sorted.size() / groups + (g < sorted.size() % groups);
+            LeafNode *leaf = new_leaf();
+            level.push_back(leaf);
+            for (size_t i = 0; i < share; ++i) {
+                leaf->keys[leaf->keys_counter++] = sorted[pos++];
+            }
+            if (previous) {
+                previous->set_next(leaf);
+                firsts.push_back(separator::shorten(previous->keys[previous->keys_counter-1], leaf->keys[0]));
             } else {
-                start = middle;
+                firsts.push_back(leaf->keys[0]);
             }
-            middle = start + ((end - start) / 2);
+            leaf->set_prev(previous);
+            previous = leaf;
+            sizes.push_back(share);
         }
         
-        for (size_t i = keys_counter; i > middle; --i) {
-            keys[i] = keys[i-1];
+        // building internal levels on top until one node is left
+        target = std::max(internal_n+1, std::min(2*internal_n+1, (size_t)((2*internal_n+1)*fill_factor)));
+        while (level.size() > 1) {
+            groups = bulk_groups(level.size(), internal_n+1, target);
+            
+            std::vector<key_type> upper_firsts;
+            std::vector<size_type> upper_sizes;
+            upper.reserve(groups);
+            upper_firsts.reserve(groups);
+            upper_sizes.reserve(groups);
+            
+            pos = 0;
+            for (size_t g = 0; g < groups; ++g) {
+                size_t share = level.size() / groups + (g < level.size() % groups);
+                InternalNode *node = new_internal();
+                upper.push_back(node);
+                size_type below = 0;
+                upper_firsts.push_back(firsts[pos]);
+                for (size_t i = 0; i < share; ++i, ++pos) {
+                    if (i > 0) {
+                        node->keys[node->keys_counter++] = firsts[pos];
+                    }
+                    level[pos]->set_parent(node);
+                    node->counts[node->children_counter] = sizes[pos];
+                    node->children[node->children_counter++] = level[pos];
+                    below += sizes[pos];
+                }
+                upper_sizes.push_back(below);
+            }
+            level.swap(upper);
+            upper.clear();
+            firsts.swap(upper_firsts);
+            sizes.swap(upper_sizes);
+            new_depth += 1;
+        }
+    } catch (...) {
+        // nodes of the level below that got a parent go along with it
+        for (Node *node : upper) {
+            destroy(node);
+        }
+        for (Node *node : level) {
+            if (!node->parent) {
+                destroy(node);
+            }
         }
-        keys[middle + 1] = key;
-        ++keys_counter;
-        return middle+1;
+        throw;
+    }
+    
+    new_root = level[0];
+    new_root->set_parent(nullptr);
+    if (root) {
+        destroy(root);
+    }
+    root = new_root;
+    depth = new_depth;
+    element_counter = (unsigned)sorted.size();
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+constexpr char ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::file_magic[8];
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+constexpr size_t ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::leaf_n;
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+constexpr size_t ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::internal_n;
+
+//#pragma mark - Node methods
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Node::Node(bool _leaf) {
+    parent = nullptr;
+    leaf = _leaf;
+    keys_counter = 0;
+    refs = 1;
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::LeafNode::LeafNode(): Node(true) {
+    next = nullptr;
+    prev = nullptr;
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::InternalNode::InternalNode(): Node(false) {
+    children_counter = 0;
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::value_type* ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Node::key_array() {
+    if (leaf) {
+        return static_cast<LeafNode*>(this)->keys;
     }
+    return static_cast<InternalNode*>(this)->keys;
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <typename K>
+int ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::LeafNode::add(K&& key, const key_compare& compare) {
+    return Node::add(keys, this->keys_counter, std::forward<K>(key), compare);
+}
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <typename K>
+int ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::InternalNode::add(K&& key, const key_compare& compare) {
+    return Node::add(keys, this->keys_counter, std::forward<K>(key), compare);
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <typename K>
+int ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Node::add(value_type* keys, unsigned& keys_counter, K&& key, const key_compare& compare) {
+    unsigned index = search::lower(keys, keys_counter, key, compare);
+    
+    std::move_backward(keys + index, keys + keys_counter, keys + keys_counter + 1);
+    keys[index] = std::forward<K>(key);
+    ++keys_counter;
+    return index;
 }
 
-template <typename Key, size_t N>
-void ADS_set<Key,N>::Node::set_parent(Node* _parent) {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Node::set_parent(InternalNode* _parent) {
     parent = _parent;
 }
-template <typename Key, size_t N>
-void ADS_set<Key,N>::Node::set_next(Node* _next) {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::LeafNode::set_next(LeafNode* _next) {
     next = _next;
 }
-template <typename Key, size_t N>
-void ADS_set<Key,N>::Node::set_leaf(bool _leaf) {
-    leaf = _leaf;
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::LeafNode::set_prev(LeafNode* _prev) {
+    prev = _prev;
 }
 
-template <typename Key, size_t N>
-void ADS_set<Key,N>::Node::keys_printer(ostream& o) {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Node::keys_printer(ostream& o) const {
+    const value_type *keys = const_cast<Node*>(this)->key_array();
     if (keys_counter!=0) {
         o << "[";
         for (size_t i = 0; i < keys_counter-1; ++i) {
@@ -1148,22 +2832,34 @@ void ADS_set<Key,N>::Node::keys_printer(ostream& o) {
     }
 }
 
-template <typename Key, size_t N>
-pair<typename ADS_set<Key,N>::Iterator,bool> ADS_set<Key,N>::insert_private_external(const_reference key) {
-    Node *current = find_leaf(root, key);
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <typename K>
+pair<typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Iterator,bool> ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::insert_private_external(K&& key) {
+    ensure_root();
+    unsigned path[max_depth];
+    LeafNode *current = find_leaf(root, key, compare, path);
 
-    pair<int,bool> pair = binary_search_in_node(current,0,((int)current->keys_counter)-1, key);
+    pair<int,bool> pair = search_in_node(current, key, compare);
 
     if (!pair.second) {
-        int x = insert_private_internal(current, key);
+        collect_snapshots();
+        current = touch_path(path, 1);
+        int x = insert_private_internal(current, std::forward<K>(key));
+        
+        // a split leaves leaf_n keys here, the rest went to the new right neighbour
+        if ((unsigned)x >= current->keys_counter) {
+            x -= current->keys_counter;
+            current = current->next;
+        }
         return make_pair(Iterator(current, x), !pair.second);
     }
     return make_pair(Iterator(current, pair.first), !pair.second);
 }
 
-template <typename Key, size_t N>
-int ADS_set<Key,N>::insert_private_internal(Node *current, const_reference key) {
-    int counter = current->add(key);
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <typename K>
+int ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::insert_private_internal(LeafNode *current, K&& key) {
+    int counter = current->add(std::forward<K>(key), compare);
     ++element_counter;
 
     if (has_max_num_of_keys(current)) {
@@ -1176,61 +2872,283 @@ int ADS_set<Key,N>::insert_private_internal(Node *current, const_reference key)
     return counter;
 }
 
-template <typename Key, size_t N>
-pair<int,bool> ADS_set<Key,N>::binary_search_in_node(Node *current, int start, int end, const_reference key) const{
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <typename K>
+pair<int,bool> ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::search_in_node(LeafNode *current, const K& key, const key_compare& compare) {
+    
+    unsigned index = search::lower(current->keys, current->keys_counter, key, compare);
+    
+    if (index < current->keys_counter && !compare(key,current->keys[index])) {
+        return make_pair((int)index, true);
+    }
+    return make_pair(-1, false);
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::LeafNode* ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::find_leaf_with_twin(Node* current, const_reference &key, pair<InternalNode*,int>& twin, unsigned* path) {
     
-    if (start <= end) {
-        int middle = (start + end) / 2;  // compute mid point.
-        if (middle > current->keys_counter-1) {
-            return make_pair(-1, false);
+    while (!current->leaf) {
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        unsigned i = search::upper(internal->keys, internal->keys_counter, key, compare);
+        *path++ = i;
+        
+        current = internal->children[i];
+        prefetch_node(current);
+        
+        if (i == internal->keys_counter && equal(key, internal->keys[i-1])) {
+            twin.first = internal;
+            twin.second = (int)i-1;
         }
+    }
+    return static_cast<LeafNode*>(current);
+}
 
-        if (key_compare()(key,current->keys[middle])) {
-            return binary_search_in_node(current, start, middle-1, key);
-        } else if (key_compare()(current->keys[middle],key)) {
-            return binary_search_in_node(current, middle+1, end, key);
-        } else {
-            return make_pair(middle, true);
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template <typename K>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::LeafNode* ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::find_leaf(Node* current, const K& key, const key_compare& compare, unsigned* path) {
+    while (!current->leaf) {
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        // look for right path, the first key greater than key
+        unsigned i = search::upper(internal->keys, internal->keys_counter, key, compare);
+        if (path) {
+            *path++ = i;
         }
+        
+        // the child's lines are on their way while we are still busy here
+        current = internal->children[i];
+        prefetch_node(current);
     }
-    return make_pair(-1, false);
+    return static_cast<LeafNode*>(current);
 }
 
-template <typename Key, size_t N>
-typename ADS_set<Key,N>::Node* ADS_set<Key,N>::find_leaf_with_twin(Node* current, const_reference &key, pair<Node*,int>& twin) {
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+template<typename Visit> void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::find_leaf_many(const key_type* keys, size_type n, Visit visit) const {
+    Node* current[batch_width];
     
-    if (!current->leaf) {
-        for (size_t i = 0; i < current->keys_counter; ++i) {
-            if (key_compare{}(key,current->keys[i])) {
-                if (equal(key, current->keys[i])) {
-                    twin.first = current;
-                    twin.second = (int)i-1;
-                }
-                return find_leaf_with_twin(current->children[i], key, twin);
+    for (size_type first = 0; first < n; first += batch_width) {
+        size_type width = std::min(size_type(batch_width), n - first);
+        
+        for (size_type j = 0; j < width; ++j) {
+            current[j] = top();
+        }
+        
+        // all leafs are on the same depth, so the whole group steps down one level at a time.
+        // the prefetches of one descent are in flight while the others scan their nodes
+        for (int level = 0; level < depth; ++level) {
+            for (size_type j = 0; j < width; ++j) {
+                InternalNode *internal = static_cast<InternalNode*>(current[j]);
+                unsigned i = search::upper(internal->keys, internal->keys_counter, keys[first+j], compare);
+                
+                current[j] = internal->children[i];
+                prefetch_node(current[j]);
             }
         }
-        if (equal(key, current->keys[current->children_counter-2])) {
-            twin.first = current;
-            twin.second = current->children_counter-2;
+        
+        for (size_type j = 0; j < width; ++j) {
+            visit(first+j, static_cast<LeafNode*>(current[j]));
+        }
+    }
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::prefetch_node(const Node* node) {
+    const char *address = reinterpret_cast<const char*>(node);
+    for (size_t offset = 0; offset < prefetch_bytes; offset += 64) {
+        ADS_PREFETCH(address + offset);
+    }
+}
+
+//#pragma mark - order statistics
+
+// walks the recorded path down, takes every node on it over from the snapshots
+// and fixes the count of every child on it. returns the leaf at its end
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::LeafNode* ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::touch_path(const unsigned* path, difference_type delta, InternalNode** twin) {
+    Node *current = root;
+    for (int level = 0;; ++level) {
+        Node *owned = unshare(current, level ? path[level-1] : 0);
+        if (twin && *twin == current) {
+            *twin = static_cast<InternalNode*>(owned);
+        }
+        if (level == depth) {
+            return static_cast<LeafNode*>(owned);
         }
-        return find_leaf_with_twin(current->children[current->children_counter-1], key, twin);
+        InternalNode *internal = static_cast<InternalNode*>(owned);
+        internal->counts[path[level]] += delta;
+        current = internal->children[path[level]];
     }
-    return current;
 }
 
-template <typename Key, size_t N>
-typename ADS_set<Key,N>::Node* ADS_set<Key,N>::find_leaf(Node* current, const_reference &key) const {
-    if (!current->leaf) {
-        // look for right path
-        for (size_t i = 0; i < current->keys_counter; ++i) {
-            if (key_compare{}(key,current->keys[i])) {
-                return find_leaf(current->children[i], key);
-            }
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::size_type ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::subtree_size(const Node* current) {
+    if (current->leaf) {
+        return current->keys_counter;
+    }
+    const InternalNode *internal = static_cast<const InternalNode*>(current);
+    size_type below = 0;
+    for (size_t i = 0; i < internal->children_counter; ++i) {
+        below += internal->counts[i];
+    }
+    return below;
+}
+
+// position of (leaf, index) in the whole set, the siblings left of the way up count in
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::size_type ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::rank_of(const LeafNode* leaf, size_type index) {
+    size_type position = index;
+    const Node *current = leaf;
+    
+    while (current->parent) {
+        const InternalNode *parent = current->parent;
+        for (size_t i = 0; parent->children[i] != current; ++i) {
+            position += parent->counts[i];
+        }
+        current = parent;
+    }
+    return position;
+}
+
+// leaf holding the k-th key below current, k becomes the index in it.
+// k equal to the size ends in the last leaf behind its last key
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::LeafNode* ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::select_leaf(Node* current, size_type& k) {
+    while (!current->leaf) {
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        size_t i = 0;
+        while (i+1 < internal->children_counter && k >= internal->counts[i]) {
+            k -= internal->counts[i];
+            ++i;
+        }
+        current = internal->children[i];
+        prefetch_node(current);
+    }
+    return static_cast<LeafNode*>(current);
+}
+
+//#pragma mark - copy on write
+
+// current sits at children[index] of its parent (or is the root). a node that is
+// shared with a snapshot is copied, the copy takes its place in the live tree
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Node* ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::unshare(Node* current, size_t index) {
+    if (current->refs == 1) {
+        return current;
+    }
+    
+    Node *copy;
+    if (current->leaf) {
+        LeafNode *leaf = new (leaf_pool.allocate()) LeafNode(*static_cast<LeafNode*>(current));
+        if (leaf->prev) {
+            leaf->prev->set_next(leaf);
+        }
+        if (leaf->next) {
+            leaf->next->set_prev(leaf);
+        }
+        copy = leaf;
+    } else {
+        InternalNode *internal = new (internal_pool.allocate()) InternalNode(*static_cast<InternalNode*>(current));
+        
+        // the children get a second parent, the live one is the copy
+        for (size_t i = 0; i < internal->children_counter; ++i) {
+            internal->children[i]->refs += 1;
+            internal->children[i]->set_parent(internal);
         }
-        return find_leaf(current->children[current->children_counter-1], key);
+        copy = internal;
+    }
+    copy->refs = 1;
+    current->refs -= 1;
+    
+    if (copy->parent) {
+        copy->parent->children[index] = copy;
+    } else {
+        root = copy;
+    }
+    return copy;
+}
+
+// drops the roots of the snapshots that are gone
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+void ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::collect_snapshots() {
+    if (!snapshots || !snapshots->pending.load(std::memory_order_acquire)) {
+        return;
     }
-    return current;
+    std::lock_guard<std::mutex> guard(snapshots->lock);
+    for (Node *released : snapshots->released) {
+        destroy(released);
+    }
+    snapshots->outstanding -= snapshots->released.size();
+    snapshots->released.clear();
+    snapshots->pending.store(0, std::memory_order_relaxed);
+}
+
+// first leaf after leaf, found through the child pointers only
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::LeafNode* ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::successor_leaf(Node* root, const LeafNode* leaf, const key_compare& compare) {
+    if (leaf->keys_counter == 0) {
+        return nullptr;
+    }
+    const key_type& last = leaf->keys[leaf->keys_counter-1];
     
+    // the deepest node on the way with a child right of the path
+    Node *current = root;
+    Node *right = nullptr;
+    while (!current->leaf) {
+        InternalNode *internal = static_cast<InternalNode*>(current);
+        unsigned i = search::upper(internal->keys, internal->keys_counter, last, compare);
+        if (i + 1 < internal->children_counter) {
+            right = internal->children[i+1];
+        }
+        current = internal->children[i];
+    }
+    if (!right) {
+        return nullptr;
+    }
+    while (!right->leaf) {
+        right = static_cast<InternalNode*>(right)->children[0];
+    }
+    return static_cast<LeafNode*>(right);
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Snapshot_state::Snapshot_state(const Allocator& alloc): leaf_pool(alloc), internal_pool(alloc) {
+    pending.store(0);
+    outstanding = 0;
+    orphaned = false;
+}
+
+// runs in whatever thread lets go of the last copy of a snapshot
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Snapshot_root::~Snapshot_root() {
+    std::lock_guard<std::mutex> guard(state->lock);
+    if (state->orphaned) {
+        destroy(root, state->leaf_pool, state->internal_pool);
+        state->outstanding -= 1;
+        return;
+    }
+    state->released.push_back(root);
+    state->pending.store(state->released.size(), std::memory_order_release);
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Snapshot::const_iterator ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Snapshot::begin() const {
+    if (!version) {
+        return end();
+    }
+    Node *current = version->root;
+    while (!current->leaf) {
+        current = static_cast<InternalNode*>(current)->children[0];
+    }
+    return Iterator(version.get(), static_cast<LeafNode*>(current), 0);
+}
+
+template <typename Key, size_t N, typename Allocator, typename Compare, size_t LeafN, size_t InternalN>
+typename ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Snapshot::const_iterator ADS_set<Key,N,Allocator,Compare,LeafN,InternalN>::Snapshot::lower_bound(const key_type& key) const {
+    if (!version) {
+        return end();
+    }
+    LeafNode *current = find_leaf(version->root, key, version->compare);
+    unsigned index = search::lower(current->keys, current->keys_counter, key, version->compare);
+    return Iterator(version.get(), current, index);
 }
 
 #endif // ADS_SET_H
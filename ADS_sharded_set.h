@@ -0,0 +1,366 @@
+#ifndef ADS_SHARDED_SET_H
+#define ADS_SHARDED_SET_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "ADS_set.h"
+
+// key range shards, every one an ADS_set behind its own reader-writer lock.
+// writes to different ranges take different locks. shard i holds the keys in
+// [bounds[i-1], bounds[i]), the bounds follow the quantiles of the keys whenever
+// one shard has grown well above its share. operations hold the layout lock
+// shared, rebalancing holds it alone
+template <typename Key, size_t N = 0, typename Allocator = std::allocator<Key>>
+class ShardedADS_set {
+
+public:
+    class Snapshot;
+    using set_type = ADS_set<Key,N,Allocator>;
+    using value_type = Key;
+    using key_type = Key;
+    using reference = key_type&;
+    using const_reference = const key_type&;
+    using size_type = size_t;
+    using key_compare = typename set_type::key_compare;
+    using allocator_type = Allocator;
+
+private:
+#if __cplusplus >= 201703L
+    using shard_mutex = std::shared_mutex;
+#else
+    using shard_mutex = std::shared_timed_mutex;
+#endif
+
+    struct Shard {
+        mutable shard_mutex lock;
+        set_type set;
+
+        explicit Shard(const Allocator& alloc) : set(alloc) {}
+    };
+
+    mutable shard_mutex layout;
+    std::vector<key_type> bounds; // empty until the first rebalance, shard 0 takes everything
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<size_type> element_counter;
+
+private:
+    size_t shard_of(const key_type& key) const;
+    bool skewed(size_type shard_size, size_type total) const;
+    void rebalance_locked();
+
+public:
+    explicit ShardedADS_set(size_t shard_count = std::max<size_t>(1, std::thread::hardware_concurrency()), const Allocator& alloc = Allocator());
+    ShardedADS_set(const ShardedADS_set&) = delete;
+    ShardedADS_set& operator=(const ShardedADS_set&) = delete;
+
+    size_type size() const;
+    bool empty() const;
+    size_t shard_count() const;
+
+    size_type count(const key_type& key) const;
+    bool insert(const key_type& key);
+    size_type erase(const key_type& key);
+
+    // visit runs under the locks of the shards, it must not call back into the set
+    template<typename Visit> size_type scan(const key_type& lo, const key_type& hi, Visit visit) const;
+    size_type count_range(const key_type& lo, const key_type& hi) const;
+
+    // consistent ordered view over all shards
+    Snapshot snapshot() const;
+
+    // moves the bounds to the quantiles of the keys
+    void rebalance();
+};
+
+// the snapshots of all shards, taken together, iterated one after the other
+template <typename Key, size_t N, typename Allocator>
+class ShardedADS_set<Key,N,Allocator>::Snapshot {
+    friend class ShardedADS_set;
+    using part = typename set_type::Snapshot;
+
+    std::vector<part> parts;
+    std::vector<key_type> bounds;
+    size_type element_counter;
+public:
+    class Iterator;
+    using iterator = Iterator;
+    using const_iterator = Iterator;
+
+    Snapshot() : element_counter(0) {}
+
+    size_type size() const {
+        return element_counter;
+    }
+    bool empty() const {
+        return element_counter == 0;
+    }
+    size_type count(const key_type& key) const;
+    const_iterator lower_bound(const key_type& key) const;
+    const_iterator begin() const;
+    const_iterator end() const;
+};
+
+template <typename Key, size_t N, typename Allocator>
+class ShardedADS_set<Key,N,Allocator>::Snapshot::Iterator {
+private:
+    using part_iterator = typename part::const_iterator;
+
+    const Snapshot* owner;
+    size_t shard;
+    part_iterator current;
+
+    // steps over the ends of shards
+    void settle() {
+        while (shard < owner->parts.size() && current == owner->parts[shard].end()) {
+            if (++shard < owner->parts.size()) {
+                current = owner->parts[shard].begin();
+            }
+        }
+    }
+public:
+    using value_type = Key;
+    using difference_type = std::ptrdiff_t;
+    using reference = const value_type&;
+    using pointer = const value_type*;
+    using iterator_category = std::forward_iterator_tag;
+
+    Iterator() : owner(nullptr), shard(0) {}
+    explicit Iterator(const Snapshot* _owner, size_t _shard, part_iterator _current) : owner(_owner), shard(_shard), current(_current) {
+        settle();
+    }
+    reference operator*() const {
+        return *current;
+    }
+    pointer operator->() const {
+        return &*current;
+    }
+    Iterator& operator++() {
+        ++current;
+        settle();
+        return *this;
+    }
+    Iterator operator++(int) {
+        Iterator it = *this;
+        ++*this;
+        return it;
+    }
+
+    friend bool operator==(const Iterator& lhs, const Iterator& rhs) {
+        return lhs.shard == rhs.shard && lhs.current == rhs.current;
+    }
+    friend bool operator!=(const Iterator& lhs, const Iterator& rhs) {
+        return !(lhs==rhs);
+    }
+};
+
+// #pragma mark - Public ShardedADS_set methods
+
+template <typename Key, size_t N, typename Allocator>
+ShardedADS_set<Key,N,Allocator>::ShardedADS_set(size_t shard_count, const Allocator& alloc) {
+    if (shard_count == 0) {
+        throw invalid_argument("at least one shard is needed! ShardedADS_set");
+    }
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards.emplace_back(new Shard(alloc));
+    }
+    element_counter.store(0);
+}
+
+template <typename Key, size_t N, typename Allocator>
+typename ShardedADS_set<Key,N,Allocator>::size_type ShardedADS_set<Key,N,Allocator>::size() const {
+    return element_counter.load(std::memory_order_relaxed);
+}
+template <typename Key, size_t N, typename Allocator>
+bool ShardedADS_set<Key,N,Allocator>::empty() const {
+    return size() == 0;
+}
+template <typename Key, size_t N, typename Allocator>
+size_t ShardedADS_set<Key,N,Allocator>::shard_count() const {
+    return shards.size();
+}
+
+template <typename Key, size_t N, typename Allocator>
+typename ShardedADS_set<Key,N,Allocator>::size_type ShardedADS_set<Key,N,Allocator>::count(const key_type& key) const {
+    std::shared_lock<shard_mutex> guard(layout);
+    const Shard& shard = *shards[shard_of(key)];
+    std::shared_lock<shard_mutex> read(shard.lock);
+    return shard.set.count(key);
+}
+
+template <typename Key, size_t N, typename Allocator>
+bool ShardedADS_set<Key,N,Allocator>::insert(const key_type& key) {
+    bool rebalance_needed;
+    {
+        std::shared_lock<shard_mutex> guard(layout);
+        Shard& shard = *shards[shard_of(key)];
+        std::lock_guard<shard_mutex> write(shard.lock);
+
+        if (!shard.set.insert(key).second) {
+            return false;
+        }
+        size_type total = element_counter.fetch_add(1, std::memory_order_relaxed) + 1;
+        rebalance_needed = skewed(shard.set.size(), total);
+    }
+
+    // checked again once we have the layout to ourselves, somebody may have been faster
+    if (rebalance_needed) {
+        std::unique_lock<shard_mutex> guard(layout);
+        size_type total = element_counter.load(std::memory_order_relaxed);
+        for (auto& shard : shards) {
+            if (skewed(shard->set.size(), total)) {
+                rebalance_locked();
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename Key, size_t N, typename Allocator>
+typename ShardedADS_set<Key,N,Allocator>::size_type ShardedADS_set<Key,N,Allocator>::erase(const key_type& key) {
+    std::shared_lock<shard_mutex> guard(layout);
+    Shard& shard = *shards[shard_of(key)];
+    std::lock_guard<shard_mutex> write(shard.lock);
+
+    size_type erased = shard.set.erase(key);
+    element_counter.fetch_sub(erased, std::memory_order_relaxed);
+    return erased;
+}
+
+template <typename Key, size_t N, typename Allocator>
+template<typename Visit> typename ShardedADS_set<Key,N,Allocator>::size_type ShardedADS_set<Key,N,Allocator>::scan(const key_type& lo, const key_type& hi, Visit visit) const {
+    size_type visited = 0;
+    if (!key_compare()(lo, hi)) {
+        return visited;
+    }
+    std::shared_lock<shard_mutex> guard(layout);
+    for (size_t i = shard_of(lo), last = shard_of(hi); i <= last; ++i) {
+        std::shared_lock<shard_mutex> read(shards[i]->lock);
+        visited += shards[i]->set.scan(lo, hi, visit);
+    }
+    return visited;
+}
+
+template <typename Key, size_t N, typename Allocator>
+typename ShardedADS_set<Key,N,Allocator>::size_type ShardedADS_set<Key,N,Allocator>::count_range(const key_type& lo, const key_type& hi) const {
+    size_type counted = 0;
+    if (!key_compare()(lo, hi)) {
+        return counted;
+    }
+    std::shared_lock<shard_mutex> guard(layout);
+    for (size_t i = shard_of(lo), last = shard_of(hi); i <= last; ++i) {
+        std::shared_lock<shard_mutex> read(shards[i]->lock);
+        counted += shards[i]->set.count_range(lo, hi);
+    }
+    return counted;
+}
+
+// all shards are locked at once, so the view is one point in time. every part is O(1)
+template <typename Key, size_t N, typename Allocator>
+typename ShardedADS_set<Key,N,Allocator>::Snapshot ShardedADS_set<Key,N,Allocator>::snapshot() const {
+    Snapshot view;
+    std::shared_lock<shard_mutex> guard(layout);
+    for (auto& shard : shards) {
+        shard->lock.lock();
+    }
+    view.bounds = bounds;
+    view.element_counter = 0;
+    for (auto& shard : shards) {
+        view.parts.push_back(shard->set.snapshot());
+        view.element_counter += shard->set.size();
+    }
+    for (auto& shard : shards) {
+        shard->lock.unlock();
+    }
+    return view;
+}
+
+template <typename Key, size_t N, typename Allocator>
+void ShardedADS_set<Key,N,Allocator>::rebalance() {
+    std::unique_lock<shard_mutex> guard(layout);
+    rebalance_locked();
+}
+
+// #pragma mark - Private ShardedADS_set methods
+
+template <typename Key, size_t N, typename Allocator>
+size_t ShardedADS_set<Key,N,Allocator>::shard_of(const key_type& key) const {
+    return std::upper_bound(bounds.begin(), bounds.end(), key, key_compare()) - bounds.begin();
+}
+
+// a shard half again as big as its share, small sets are left alone
+template <typename Key, size_t N, typename Allocator>
+bool ShardedADS_set<Key,N,Allocator>::skewed(size_type shard_size, size_type total) const {
+    return shard_size >= 8*set_type::leaf_n && 2 * shard_size * shards.size() > 3 * total;
+}
+
+// only called with the layout lock held alone, so no shard is in use
+template <typename Key, size_t N, typename Allocator>
+void ShardedADS_set<Key,N,Allocator>::rebalance_locked() {
+    size_type total = 0;
+    for (auto& shard : shards) {
+        total += shard->set.size();
+    }
+    if (total < shards.size()) {
+        return;
+    }
+
+    // the shards are in key order, together they are sorted
+    std::vector<key_type> keys;
+    keys.reserve(total);
+    for (auto& shard : shards) {
+        keys.insert(keys.end(), shard->set.begin(), shard->set.end());
+    }
+
+    bounds.clear();
+    for (size_t i = 1; i < shards.size(); ++i) {
+        bounds.push_back(keys[i * total / shards.size()]);
+    }
+    for (size_t i = 0; i < shards.size(); ++i) {
+        auto first = keys.begin() + i * total / shards.size();
+        auto last = keys.begin() + (i + 1) * total / shards.size();
+        shards[i]->set.clear();
+        shards[i]->set.insert(first, last);
+    }
+}
+
+// #pragma mark - Snapshot methods
+
+template <typename Key, size_t N, typename Allocator>
+typename ShardedADS_set<Key,N,Allocator>::size_type ShardedADS_set<Key,N,Allocator>::Snapshot::count(const key_type& key) const {
+    if (parts.empty()) {
+        return 0;
+    }
+    size_t shard = std::upper_bound(bounds.begin(), bounds.end(), key, key_compare()) - bounds.begin();
+    return parts[shard].count(key);
+}
+
+template <typename Key, size_t N, typename Allocator>
+typename ShardedADS_set<Key,N,Allocator>::Snapshot::const_iterator ShardedADS_set<Key,N,Allocator>::Snapshot::lower_bound(const key_type& key) const {
+    if (parts.empty()) {
+        return end();
+    }
+    size_t shard = std::upper_bound(bounds.begin(), bounds.end(), key, key_compare()) - bounds.begin();
+    return Iterator(this, shard, parts[shard].lower_bound(key));
+}
+
+template <typename Key, size_t N, typename Allocator>
+typename ShardedADS_set<Key,N,Allocator>::Snapshot::const_iterator ShardedADS_set<Key,N,Allocator>::Snapshot::begin() const {
+    if (parts.empty()) {
+        return end();
+    }
+    return Iterator(this, 0, parts[0].begin());
+}
+
+template <typename Key, size_t N, typename Allocator>
+typename ShardedADS_set<Key,N,Allocator>::Snapshot::const_iterator ShardedADS_set<Key,N,Allocator>::Snapshot::end() const {
+    return Iterator(this, parts.size(), typename part::const_iterator());
+}
+
+#endif // ADS_SHARDED_SET_H
@@ -1,6 +1,12 @@
 #include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
 #include <future>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory_resource>
 #include <random>
 #include <set>
 #include <sstream>
@@ -14,6 +20,13 @@
 #include <time.h>
 
 #include "ADS_set.h"
+#include "ADS_concurrent_set.h"
+#include "ADS_sharded_set.h"
+#include "ADS_mapped_set.h"
+#include "ADS_paged_set.h"
+#include "ADS_logged_set.h"
+#include "ADS_map.h"
+#include "ADS_frozen_set.h"
 
 //#define PH2
 
@@ -95,6 +108,54 @@ namespace ads {
 #else
         ADS_set<T>;
 #endif
+
+    template <class T, class Compare>
+    using ordered_set =
+#ifdef SIZE
+        ADS_set<T, SIZE, std::allocator<T>, Compare>;
+#else
+        ADS_set<T, 0, std::allocator<T>, Compare>;
+#endif
+
+    template <class T>
+    using sharded_set =
+#ifdef SIZE
+        ShardedADS_set<T, SIZE>;
+#else
+        ShardedADS_set<T>;
+#endif
+
+    template <class T>
+    using mapped_set =
+#ifdef SIZE
+        ADS_mapped_set<T, SIZE>;
+#else
+        ADS_mapped_set<T>;
+#endif
+
+    template <class T>
+    using logged_set =
+#ifdef SIZE
+        ADS_logged_set<T, SIZE>;
+#else
+        ADS_logged_set<T>;
+#endif
+
+    template <class K, class T>
+    using map =
+#ifdef SIZE
+        ADS_map<K, T, SIZE>;
+#else
+        ADS_map<K, T>;
+#endif
+
+    template <class K, class T, class Compare>
+    using ordered_map =
+#ifdef SIZE
+        ADS_map<K, T, SIZE, std::allocator<std::pair<const K, T>>, Compare>;
+#else
+        ADS_map<K, T, 0, std::allocator<std::pair<const K, T>>, Compare>;
+#endif
 }
 
 // gestohlen aus simpletest
@@ -326,6 +387,1006 @@ void test_find(ads::set<val_t> const& a, std::set<val_t> const& r, size_t max_va
         }
     }
 }
+
+void test_find_many(ads::set<val_t> const& a, std::set<val_t> const& r, size_t max_value) {
+    std::cerr << "\n=== test_find_many ===\n";
+    std::vector<val_t> keys;
+    for(size_t i = 0; i < max_value; ++i) { keys.push_back(i); }
+
+    std::vector<bool> found;
+    std::vector<ads::set<val_t>::iterator> its(keys.size());
+    size_t hits = a.count_many(keys.data(), keys.size(), found);
+    a.find_many(keys.data(), keys.size(), its.data());
+
+    size_t expected = 0;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        std::cerr << "fm " << keys[i] << '\n';
+        auto it_r = r.find(keys[i]);
+        expected += it_r != r.end();
+
+        if(found[i] != (it_r != r.end())) {
+            std::cerr << RED("[find_many] err: count_many reports " << found[i] << " for value " << keys[i] << '\n');
+            dump_compare(a, r);
+            std::abort();
+        }
+        if(!it_equal(a, its[i], r, it_r)) {
+            std::cerr << RED("[find_many] err: returned iterators do not match expected value.\n"
+                      << "value to find was " << keys[i] << " but iterator points to " << it2str(a, its[i]) << '\n');
+            dump_compare(a, r);
+            std::abort();
+        }
+    }
+
+    if(hits != expected) {
+        std::cerr << RED("[find_many] err: count_many returned " << hits << ", but expected " << expected << '\n');
+        dump_compare(a, r);
+        std::abort();
+    }
+}
+
+void test_bounds(ads::set<val_t> const& a, std::set<val_t> const& r, size_t max_value) {
+    std::cerr << "\n=== test_bounds ===\n";
+    for(size_t i = 0; i <= max_value + 1; ++i) {
+        std::cerr << "lb " << i << '\n';
+        auto lb_r = r.lower_bound(i);
+        auto lb_a = a.lower_bound(i);
+        auto ub_r = r.upper_bound(i);
+        auto ub_a = a.upper_bound(i);
+        auto er_r = r.equal_range(i);
+        auto er_a = a.equal_range(i);
+
+        if(!it_equal(a, lb_a, r, lb_r) || !it_equal(a, ub_a, r, ub_r)) {
+            std::cerr << RED("[bounds] err: returned iterators do not match expected value for " << i << ".\n"
+                      << "lower_bound points to " << it2str(a, lb_a) << ", expected " << it2str(r, lb_r) << '\n'
+                      << "upper_bound points to " << it2str(a, ub_a) << ", expected " << it2str(r, ub_r) << '\n');
+            dump_compare(a, r);
+            std::abort();
+        }
+        if(!it_equal(a, er_a.first, r, er_r.first) || !it_equal(a, er_a.second, r, er_r.second)) {
+            std::cerr << RED("[bounds] err: equal_range does not match expected range for " << i << '\n');
+            dump_compare(a, r);
+            std::abort();
+        }
+    }
+
+    for(size_t lo = 0; lo <= max_value + 1; lo += 1 + max_value / 10) {
+        for(size_t hi = lo; hi <= max_value + 2; hi += 1 + max_value / 7) {
+            std::cerr << "sc " << lo << ' ' << hi << '\n';
+            std::vector<val_t> got;
+            size_t visited = a.scan(lo, hi, [&](val_t const& v) { got.push_back(v); });
+
+            std::vector<val_t> expected(r.lower_bound(lo), r.lower_bound(hi));
+            bool same = visited == got.size() && got.size() == expected.size();
+            for(size_t i = 0; same && i < got.size(); ++i) { same = got[i].i == expected[i].i; }
+
+            if(!same) {
+                std::cerr << RED("[bounds] err: scan(" << lo << ", " << hi << ") visited " << visited << " values, expected " << expected.size() << '\n');
+                dump_compare(a, r);
+                std::abort();
+            }
+        }
+    }
+}
+
+void test_rank(ads::set<val_t> const& a, std::set<val_t> const& r, size_t max_value) {
+    std::cerr << "\n=== test_rank ===\n";
+    for(size_t i = 0; i <= max_value + 1; ++i) {
+        std::cerr << "rk " << i << '\n';
+        size_t rank_r = std::distance(r.begin(), r.lower_bound(i));
+        size_t rank_a = a.rank(i);
+
+        if(rank_a != rank_r) {
+            std::cerr << RED("[rank] err: rank(" << i << ") returned " << rank_a << ", expected " << rank_r << '\n');
+            dump_compare(a, r);
+            std::abort();
+        }
+        size_t hi = i + max_value / 5;
+        size_t range_r = std::distance(r.lower_bound(i), r.lower_bound(hi));
+        if(a.count_range(i, hi) != range_r) {
+            std::cerr << RED("[rank] err: count_range(" << i << ", " << hi << ") returned " << a.count_range(i, hi) << ", expected " << range_r << '\n');
+            dump_compare(a, r);
+            std::abort();
+        }
+    }
+
+    size_t k = 0;
+    for(auto it_r = r.begin(); it_r != r.end(); ++it_r, ++k) {
+        auto it_a = a.select(k);
+        if(it_a == a.end() || it_a->i != it_r->i) {
+            std::cerr << RED("[rank] err: select(" << k << ") points to " << it2str(a, it_a) << ", expected " << *it_r << '\n');
+            dump_compare(a, r);
+            std::abort();
+        }
+        if(size_t(it_a - a.begin()) != k || a.begin() + k != it_a || size_t(a.end() - it_a) != r.size() - k) {
+            std::cerr << RED("[rank] err: iterator distance to select(" << k << ") is wrong\n");
+            dump_compare(a, r);
+            std::abort();
+        }
+    }
+    if(a.select(r.size()) != a.end()) {
+        std::cerr << RED("[rank] err: select(size()) is not end()\n");
+        dump_compare(a, r);
+        std::abort();
+    }
+}
+
+template <class RNG>
+void test_snapshot(ads::set<val_t>& a, std::set<val_t>& r, size_t n, size_t max_value, RNG&& gen) {
+    std::cerr << "\n=== test_snapshot ===\n";
+    std::uniform_int_distribution<size_t> dist_i{ 0, max_value };
+    std::uniform_real_distribution<double> dist_f{ 0, 1 };
+
+    auto snapshot = a.snapshot();
+    std::set<val_t> const before = r;
+
+    // the set goes on, the snapshot must not notice
+    for(size_t i = 0; i < n; ++i) {
+        val_t v{ dist_i(gen) };
+        if(dist_f(gen) < 0.5) {
+            a.insert(v);
+            r.insert(v);
+        } else {
+            a.erase(v);
+            r.erase(v);
+        }
+    }
+
+    if(snapshot.size() != before.size()) {
+        std::cerr << RED("[snapshot] err: size changed from " << before.size() << " to " << snapshot.size() << '\n');
+        std::abort();
+    }
+    auto it_s = snapshot.begin();
+    for(auto const& v : before) {
+        if(it_s == snapshot.end() || it_s->i != v.i) {
+            std::cerr << RED("[snapshot] err: expected " << v << " while iterating the snapshot\n");
+            std::abort();
+        }
+        ++it_s;
+    }
+    if(it_s != snapshot.end()) {
+        std::cerr << RED("[snapshot] err: snapshot has more values than it had when it was taken\n");
+        std::abort();
+    }
+    for(size_t i = 0; i <= max_value + 1; ++i) {
+        if(snapshot.count(i) != before.count(i)) {
+            std::cerr << RED("[snapshot] err: count(" << i << ") returned " << snapshot.count(i) << ", expected " << before.count(i) << '\n');
+            std::abort();
+        }
+    }
+
+    if(a != r) {
+        std::cerr << RED("[snapshot] err: set does not match expected values after writing next to a snapshot\n");
+        dump_compare(a, r);
+        std::abort();
+    }
+}
+
+template <class RNG>
+void test_algebra(ads::set<val_t> const& a, std::set<val_t> const& r, size_t max_value, RNG&& gen) {
+    std::cerr << "\n=== test_algebra ===\n";
+    std::uniform_int_distribution<size_t> dist_i{ max_value / 2, max_value + max_value / 2 };
+    ads::set<val_t> b;
+    std::set<val_t> s;
+    for(size_t i = 0; i < r.size(); ++i) {
+        val_t v{ dist_i(gen) };
+        b.insert(v);
+        s.insert(v);
+    }
+
+    auto check = [&](ads::set<val_t> const& got, std::set<val_t> const& expected, char const* what) {
+        if(got != expected) {
+            std::cerr << RED("[algebra] err: " << what << " does not match\n");
+            dump_compare(got, expected);
+            std::abort();
+        }
+    };
+    std::set<val_t> expected;
+    std::set_union(r.begin(), r.end(), s.begin(), s.end(), std::inserter(expected, expected.end()), std::less<val_t>{});
+    check(set_union(a, b), expected, "set_union");
+    expected.clear();
+    std::set_intersection(r.begin(), r.end(), s.begin(), s.end(), std::inserter(expected, expected.end()), std::less<val_t>{});
+    check(set_intersection(a, b), expected, "set_intersection");
+    expected.clear();
+    std::set_difference(r.begin(), r.end(), s.begin(), s.end(), std::inserter(expected, expected.end()), std::less<val_t>{});
+    check(set_difference(a, b), expected, "set_difference");
+    expected.clear();
+    std::set_difference(s.begin(), s.end(), r.begin(), r.end(), std::inserter(expected, expected.end()), std::less<val_t>{});
+    check(set_difference(b, a), expected, "set_difference");
+
+    if(includes(a, b) != std::includes(r.begin(), r.end(), s.begin(), s.end(), std::less<val_t>{}) || !includes(a, set_intersection(a, b)) || !includes(set_union(a, b), a)) {
+        std::cerr << RED("[algebra] err: includes does not match\n");
+        std::abort();
+    }
+}
+
+void test_save_load(ads::set<val_t> const& a, std::set<val_t> const& r) {
+    std::cerr << "\n=== test_save_load ===\n";
+    std::stringstream file;
+    a.save(file);
+
+    ads::set<val_t> loaded{ 1, 2, 3 };
+    loaded.load(file);
+    if(loaded != r || loaded.size() != r.size()) {
+        std::cerr << RED("[save_load] err: loaded set does not match the saved one\n");
+        dump_compare(loaded, r);
+        std::abort();
+    }
+    loaded.insert(val_t(0));
+    loaded.erase(val_t(0));
+
+    auto rejects = [](std::string const& bytes) {
+        std::stringstream broken{ bytes };
+        ads::set<val_t> b;
+        try {
+            b.load(broken);
+        } catch(std::runtime_error const&) {
+            return true;
+        }
+        return false;
+    };
+    std::string const bytes = file.str();
+    if(!rejects("") || !rejects("not a set, clearly not a set")) {
+        std::cerr << RED("[save_load] err: load accepted a file without a valid header\n");
+        std::abort();
+    }
+    if(!r.empty() && !rejects(bytes.substr(0, bytes.size() - 1))) {
+        std::cerr << RED("[save_load] err: load accepted a truncated file\n");
+        std::abort();
+    }
+}
+
+void test_mapped(ads::set<val_t> const& a, std::set<val_t> const& r, size_t max_value) {
+    std::cerr << "\n=== test_mapped ===\n";
+    char const* path = "btest_mapped.bin";
+    ads::mapped_set<val_t>::write(a, path);
+    ads::mapped_set<val_t> mapped{ path };
+    std::remove(path); // the mapping stays valid
+
+    if(mapped.size() != r.size() || mapped.empty() != r.empty()) {
+        std::cerr << RED("[mapped] err: size is " << mapped.size() << ", expected " << r.size() << '\n');
+        std::abort();
+    }
+    auto it_m = mapped.begin();
+    for(auto const& v: r) {
+        if(it_m == mapped.end() || it_m->i != v.i) {
+            std::cerr << RED("[mapped] err: expected " << v << " while iterating over the mapped set\n");
+            std::abort();
+        }
+        ++it_m;
+    }
+    if(it_m != mapped.end()) {
+        std::cerr << RED("[mapped] err: iteration over the mapped set has more values than expected\n");
+        std::abort();
+    }
+
+    for(size_t i = 0; i <= max_value + 1; ++i) {
+        auto lb_r = r.lower_bound(i);
+        auto lb_m = mapped.lower_bound(i);
+        auto ub_r = r.upper_bound(i);
+        auto ub_m = mapped.upper_bound(i);
+        if(mapped.count(i) != r.count(i) || (lb_r == r.end()) != (lb_m == mapped.end()) || (lb_r != r.end() && lb_r->i != lb_m->i)
+           || (ub_r == r.end()) != (ub_m == mapped.end()) || (ub_r != r.end() && ub_r->i != ub_m->i)) {
+            std::cerr << RED("[mapped] err: count or bounds of " << i << " do not match\n");
+            std::abort();
+        }
+        if((mapped.find(i) == mapped.end()) != (r.find(i) == r.end())) {
+            std::cerr << RED("[mapped] err: find(" << i << ") does not match\n");
+            std::abort();
+        }
+    }
+
+    ads::mapped_set<val_t> moved{ std::move(mapped) };
+    if(moved.size() != r.size() || mapped.size() || !mapped.empty() || mapped.begin() != mapped.end()
+       || mapped.count(val_t(0)) || mapped.lower_bound(val_t(0)) != mapped.end() || mapped.upper_bound(val_t(0)) != mapped.end()) {
+        std::cerr << RED("[mapped] err: moved-from mapped set is not empty\n");
+        std::abort();
+    }
+
+    {
+        std::ofstream broken{ path, std::ios::binary };
+        broken << "not a mapped set, clearly not a mapped set, not at all";
+    }
+    bool rejected = false;
+    try {
+        ads::mapped_set<val_t> bad{ path };
+    } catch(std::runtime_error const&) {
+        rejected = true;
+    }
+    std::remove(path);
+    if(!rejected) {
+        std::cerr << RED("[mapped] err: a file without a valid header was mapped\n");
+        std::abort();
+    }
+}
+
+void test_frozen(ads::set<val_t> const& a, std::set<val_t> const& r, size_t max_value) {
+    std::cerr << "\n=== test_frozen ===\n";
+    auto frozen = a.freeze();
+
+    if(frozen.size() != r.size() || frozen.empty() != r.empty()) {
+        std::cerr << RED("[frozen] err: size is " << frozen.size() << ", expected " << r.size() << '\n');
+        std::abort();
+    }
+    if(!std::equal(frozen.begin(), frozen.end(), r.begin(), r.end(), [](val_t const& lhs, val_t const& rhs) { return lhs.i == rhs.i; })) {
+        std::cerr << RED("[frozen] err: iteration over the frozen set does not match\n");
+        std::abort();
+    }
+    if(!r.empty() && (--frozen.end())->i != r.rbegin()->i) {
+        std::cerr << RED("[frozen] err: last value is " << *--frozen.end() << ", expected " << *r.rbegin() << '\n');
+        std::abort();
+    }
+
+    std::vector<val_t> probes;
+    for(size_t i = 0; i <= max_value + 1; ++i) {
+        probes.push_back(i);
+        auto lb_r = r.lower_bound(i);
+        auto lb_f = frozen.lower_bound(i);
+        auto ub_r = r.upper_bound(i);
+        auto ub_f = frozen.upper_bound(i);
+        if(frozen.count(i) != r.count(i) || (lb_r == r.end()) != (lb_f == frozen.end()) || (lb_r != r.end() && lb_r->i != lb_f->i)
+           || (ub_r == r.end()) != (ub_f == frozen.end()) || (ub_r != r.end() && ub_r->i != ub_f->i)) {
+            std::cerr << RED("[frozen] err: count or bounds of " << i << " do not match\n");
+            std::abort();
+        }
+        if((frozen.find(i) == frozen.end()) != (r.find(i) == r.end())) {
+            std::cerr << RED("[frozen] err: find(" << i << ") does not match\n");
+            std::abort();
+        }
+    }
+    std::vector<bool> found;
+    size_t hits = frozen.count_many(probes.data(), probes.size(), found);
+    for(size_t i = 0; i < probes.size(); ++i) {
+        if(found[i] != (r.count(probes[i]) == 1)) {
+            std::cerr << RED("[frozen] err: count_many disagrees on " << probes[i] << '\n');
+            std::abort();
+        }
+    }
+    if(hits != size_t(std::count(found.begin(), found.end(), true))) {
+        std::cerr << RED("[frozen] err: count_many counted " << hits << " hits\n");
+        std::abort();
+    }
+}
+
+void check_sharded(ads::sharded_set<val_t> const& a, std::set<val_t> const& r, size_t max_value) {
+    if(a.size() != r.size()) {
+        std::cerr << RED("[sharded] err: size is " << a.size() << ", expected " << r.size() << '\n');
+        std::abort();
+    }
+    for(size_t i = 0; i <= max_value + 1; ++i) {
+        if(a.count(i) != r.count(i)) {
+            std::cerr << RED("[sharded] err: count(" << i << ") returned " << a.count(i) << ", expected " << r.count(i) << '\n');
+            std::abort();
+        }
+    }
+
+    auto view = a.snapshot();
+    auto it_v = view.begin();
+    for(auto const& v : r) {
+        if(it_v == view.end() || it_v->i != v.i) {
+            std::cerr << RED("[sharded] err: expected " << v << " while iterating over the shards\n");
+            std::abort();
+        }
+        ++it_v;
+    }
+    if(it_v != view.end()) {
+        std::cerr << RED("[sharded] err: iteration over the shards has more values than expected\n");
+        std::abort();
+    }
+
+    for(size_t lo = 0; lo <= max_value + 1; lo += 1 + max_value / 10) {
+        for(size_t hi = lo; hi <= max_value + 2; hi += 1 + max_value / 7) {
+            std::vector<val_t> got;
+            size_t visited = a.scan(lo, hi, [&](val_t const& v) { got.push_back(v); });
+
+            std::vector<val_t> expected(r.lower_bound(lo), r.lower_bound(hi));
+            bool same = visited == got.size() && got.size() == expected.size() && a.count_range(lo, hi) == expected.size();
+            for(size_t i = 0; same && i < got.size(); ++i) { same = got[i].i == expected[i].i; }
+
+            if(!same) {
+                std::cerr << RED("[sharded] err: scan(" << lo << ", " << hi << ") visited " << visited << " values, expected " << expected.size() << '\n');
+                std::abort();
+            }
+        }
+    }
+}
+
+template <class RNG>
+void test_sharded(size_t n, size_t max_value, RNG&& gen) {
+    std::cerr << "\n=== test_sharded ===\n";
+    std::uniform_int_distribution<size_t> dist_i{ 0, max_value };
+    std::uniform_real_distribution<double> dist_f{ 0, 1 };
+
+    ads::sharded_set<val_t> a(4);
+    std::set<val_t> r;
+
+    for(size_t i = 0; i < n; ++i) {
+        val_t v{ dist_i(gen) };
+        if(dist_f(gen) < 0.7) {
+            if(a.insert(v) != r.insert(v).second) {
+                std::cerr << RED("[sharded] err: mismatch of insertion status for " << v << '\n');
+                std::abort();
+            }
+        } else if(a.erase(v) != r.erase(v)) {
+            std::cerr << RED("[sharded] err: returned count for erase does not match expected value for " << v << '\n');
+            std::abort();
+        }
+    }
+    check_sharded(a, r, max_value);
+
+    // everything lands in the last shard until the bounds move
+    size_t const grown = max_value + 3000;
+    for(size_t i = max_value + 1; i <= grown; ++i) {
+        a.insert(i);
+        r.insert(i);
+    }
+    check_sharded(a, r, grown);
+
+    a.rebalance();
+    check_sharded(a, r, grown);
+}
+
+void check_paged(ADS_paged_set<val_t> const& a, std::set<val_t> const& r, size_t max_value) {
+    if(a.size() != r.size()) {
+        std::cerr << RED("[paged] err: size is " << a.size() << ", expected " << r.size() << '\n');
+        std::abort();
+    }
+    auto it_a = a.begin();
+    for(auto const& v: r) {
+        if(it_a == a.end() || it_a->i != v.i) {
+            std::cerr << RED("[paged] err: expected " << v << " while iterating over the pages\n");
+            a.dump();
+            std::abort();
+        }
+        ++it_a;
+    }
+    if(it_a != a.end()) {
+        std::cerr << RED("[paged] err: iteration over the pages has more values than expected\n");
+        std::abort();
+    }
+    for(size_t i = 0; i <= max_value + 1; ++i) {
+        auto lb_r = r.lower_bound(i);
+        auto lb_a = a.lower_bound(i);
+        if(a.count(i) != r.count(i) || (lb_r == r.end()) != (lb_a == a.end()) || (lb_r != r.end() && lb_r->i != lb_a->i)) {
+            std::cerr << RED("[paged] err: count or lower_bound of " << i << " do not match\n");
+            a.dump();
+            std::abort();
+        }
+    }
+}
+
+template <class RNG>
+void test_paged(size_t n, size_t max_value, RNG&& gen) {
+    std::cerr << "\n=== test_paged ===\n";
+    std::uniform_int_distribution<size_t> dist_i{ 0, max_value };
+    std::uniform_real_distribution<double> dist_f{ 0, 1 };
+    char const* path = "btest_paged.bin";
+    size_t const page_size = 256;
+    std::remove(path);
+
+    std::set<val_t> r;
+    {
+        // eight frames, the pool evicts all the time
+        ADS_paged_set<val_t> a(path, 8 * page_size, page_size);
+        for(size_t i = 0; i < n; ++i) {
+            val_t v{ dist_i(gen) };
+            if(dist_f(gen) < 0.7) {
+                if(a.insert(v).second != r.insert(v).second) {
+                    std::cerr << RED("[paged] err: mismatch of insertion status for " << v << '\n');
+                    std::abort();
+                }
+            } else if(a.erase(v) != r.erase(v)) {
+                std::cerr << RED("[paged] err: returned count for erase does not match expected value for " << v << '\n');
+                std::abort();
+            }
+        }
+        check_paged(a, r, max_value);
+    }
+
+    // everything was written back on close
+    ADS_paged_set<val_t> a(path, 8 * page_size, page_size);
+    check_paged(a, r, max_value);
+    for(auto const& v: std::vector<val_t>(r.begin(), r.end())) {
+        if(dist_f(gen) < 0.8) {
+            a.erase(v);
+            r.erase(v);
+        }
+    }
+    check_paged(a, r, max_value);
+    a.clear();
+    r.clear();
+    check_paged(a, r, max_value);
+    std::remove(path);
+}
+
+template <class RNG>
+void test_logged(size_t n, size_t max_value, RNG&& gen) {
+    std::cerr << "\n=== test_logged ===\n";
+    std::uniform_int_distribution<size_t> dist_i{ 0, max_value };
+    std::uniform_real_distribution<double> dist_f{ 0, 1 };
+    char const* checkpoint = "btest_checkpoint.bin";
+    char const* log = "btest_wal.log";
+    std::remove(checkpoint);
+    std::remove(log);
+
+    std::set<val_t> r;
+    auto check = [&](char const* when) {
+        ads::logged_set<val_t> a(checkpoint, log);
+        if(a.contents() != r) {
+            std::cerr << RED("[logged] err: recovered set does not match " << when << '\n');
+            dump_compare(a.contents(), r);
+            std::abort();
+        }
+    };
+    auto change = [&](ads::logged_set<val_t>& a) {
+        for(size_t i = 0; i < n; ++i) {
+            val_t v{ dist_i(gen) };
+            if(dist_f(gen) < 0.7) {
+                if(a.insert(v) != r.insert(v).second) {
+                    std::cerr << RED("[logged] err: mismatch of insertion status for " << v << '\n');
+                    std::abort();
+                }
+            } else if(a.erase(v) != r.erase(v)) {
+                std::cerr << RED("[logged] err: returned count for erase does not match expected value for " << v << '\n');
+                std::abort();
+            }
+            if(i % 64 == 0) { a.commit(); }
+        }
+        a.commit();
+    };
+
+    {
+        ads::logged_set<val_t> a(checkpoint, log, 1024);
+        change(a);
+        check("from the log alone");
+        a.checkpoint();
+        check("right after a checkpoint");
+        change(a);
+        check("from the checkpoint and the log");
+    }
+
+    // a torn frame at the end is dropped
+    {
+        std::ofstream o{ log, std::ios::binary | std::ios::app };
+        o << "torn frame, torn frame";
+    }
+    check("behind a torn frame");
+    std::remove(checkpoint);
+    std::remove(log);
+}
+
+template <class RNG>
+void test_string_keys(size_t n, size_t max_value, RNG&& gen) {
+    std::cerr << "\n=== test_string_keys ===\n";
+    std::uniform_int_distribution<size_t> dist_i{ 0, max_value };
+    char const* hosts[] = { "https://www.example.com/a/", "https://www.example.com/", "https://www.example.org/", "" };
+
+    // long shared prefixes and keys that are prefixes of other keys
+    auto make = [&]() {
+        std::string key{ hosts[dist_i(gen) % 4] };
+        key += std::to_string(dist_i(gen));
+        key.resize(key.size() - dist_i(gen) % 2);
+        return key;
+    };
+
+    ads::set<std::string> a;
+    std::set<std::string> r;
+    for(size_t i = 0; i < 2 * n; ++i) {
+        std::string key = make();
+        if(a.insert(key).second != r.insert(key).second) {
+            std::cerr << RED("[string_keys] err: insert(" << key << ") disagrees\n");
+            std::abort();
+        }
+        if(i % 3 == 0) {
+            key = make();
+            if(a.erase(key) != r.erase(key)) {
+                std::cerr << RED("[string_keys] err: erase(" << key << ") disagrees\n");
+                std::abort();
+            }
+        }
+    }
+    for(size_t i = 0; i < n; ++i) {
+        std::string key = make();
+        auto lb = a.lower_bound(key);
+        auto rl = r.lower_bound(key);
+        if(a.count(key) != r.count(key) || (lb == a.end()) != (rl == r.end()) || (rl != r.end() && *lb != *rl)) {
+            std::cerr << RED("[string_keys] err: lookup of " << key << " disagrees\n");
+            std::abort();
+        }
+    }
+    std::vector<std::string> sorted(r.begin(), r.end());
+    ads::set<std::string> b(sorted.begin(), sorted.end());
+    if(a.size() != r.size() || !std::equal(a.begin(), a.end(), r.begin()) || b != a) {
+        std::cerr << RED("[string_keys] err: string set does not match\n");
+        std::abort();
+    }
+}
+template <class RNG>
+void test_map(size_t n, size_t max_value, RNG&& gen) {
+    std::cerr << "\n=== test_map ===\n";
+    std::uniform_int_distribution<size_t> dist_i{ 0, max_value };
+
+    ads::map<val_t, std::string> a;
+    std::map<val_t, std::string> r;
+    for(size_t i = 0; i < 2 * n; ++i) {
+        val_t key{ dist_i(gen) };
+        std::string value = std::to_string(dist_i(gen));
+        switch(i % 5) {
+            case 0: {
+                auto p = a.try_emplace(key, value);
+                auto q = r.emplace(key, value);
+                if(p.second != q.second || p.first == a.end() || p.first->second != q.first->second) {
+                    std::cerr << RED("[map] err: try_emplace(" << key << ") disagrees\n");
+                    std::abort();
+                }
+                break;
+            }
+            case 1: {
+                auto p = a.insert_or_assign(key, value);
+                bool inserted = r.count(key) == 0;
+                r[key] = value;
+                if(p.second != inserted || p.first->first.i != key.i || p.first->second != value) {
+                    std::cerr << RED("[map] err: insert_or_assign(" << key << ") disagrees\n");
+                    std::abort();
+                }
+                break;
+            }
+            case 2:
+                a[key] += value;
+                r[key] += value;
+                break;
+            default:
+                if(a.erase(key) != r.erase(key)) {
+                    std::cerr << RED("[map] err: erase(" << key << ") disagrees\n");
+                    std::abort();
+                }
+        }
+    }
+
+    for(size_t i = 0; i <= max_value; ++i) {
+        auto it = a.find(val_t(i));
+        auto rt = r.find(val_t(i));
+        if((it == a.end()) != (rt == r.end()) || (rt != r.end() && it->second != rt->second) || a.count(val_t(i)) != r.count(val_t(i))) {
+            std::cerr << RED("[map] err: find(" << i << ") disagrees\n");
+            std::abort();
+        }
+        auto lb = a.lower_bound(val_t(i));
+        auto rl = r.lower_bound(val_t(i));
+        if((lb == a.end()) != (rl == r.end()) || (rl != r.end() && lb->first.i != rl->first.i)) {
+            std::cerr << RED("[map] err: lower_bound(" << i << ") disagrees\n");
+            std::abort();
+        }
+    }
+    bool thrown = false;
+    try {
+        a.at(val_t(max_value + 1));
+    } catch(std::out_of_range const&) {
+        thrown = true;
+    }
+
+    ads::map<val_t, std::string> const b{ a };
+    auto it = b.begin();
+    for(auto const& kv: r) {
+        if(it == b.end() || (*it).first.i != kv.first.i || (*it).second != kv.second || b.at(kv.first) != kv.second) {
+            std::cerr << RED("[map] err: copy does not match at " << kv.first << '\n');
+            std::abort();
+        }
+        ++it;
+    }
+    if(!thrown || it != b.end() || a.size() != r.size() || b != a) {
+        std::cerr << RED("[map] err: map does not match\n");
+        std::abort();
+    }
+
+    static_assert(std::is_nothrow_move_constructible<ads::map<val_t, std::string>>::value, "map move construction may throw");
+    static_assert(std::is_nothrow_move_assignable<ads::map<val_t, std::string>>::value, "map move assignment may throw");
+    ads::map<val_t, std::string> c{ std::move(a) };
+    if(c != b || !a.empty() || a.begin() != a.end() || a.count(val_t(0)) || a.erase(val_t(0))) {
+        std::cerr << RED("[map] err: move construction did not take all values\n");
+        std::abort();
+    }
+    a[val_t(0)] = "again";
+    a = std::move(c);
+    if(a != b || !c.empty() || c.find(val_t(0)) != c.end()) {
+        std::cerr << RED("[map] err: move assignment did not take all values\n");
+        std::abort();
+    }
+}
+// hands out blocks from upstream and remembers them, freeing a block it did not hand out fails the test
+class tracking_resource: public std::pmr::memory_resource {
+    std::set<void*> live;
+    char const* name;
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        void* p = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        live.insert(p);
+        return p;
+    }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        if(!live.erase(p)) {
+            std::cerr << RED("[pmr] err: " << name << " frees a block it did not hand out\n");
+            std::abort();
+        }
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override {
+        return this == &other;
+    }
+public:
+    explicit tracking_resource(char const* _name): name{ _name } {}
+    size_t blocks() const { return live.size(); }
+};
+
+template <typename RNG>
+void test_pmr_move(size_t n, size_t max_value, RNG&& gen) {
+    std::cerr << "\n=== test_pmr_move ===\n";
+    std::uniform_int_distribution<size_t> dist_i{ 0, max_value };
+    using pmr_set = ADS_set<size_t, 0, std::pmr::polymorphic_allocator<size_t>>;
+
+    tracking_resource ra{ "A" }, rb{ "B" };
+    {
+        pmr_set a{ &ra }, b{ &rb }, c{ &rb };
+        std::set<size_t> r;
+        for(size_t i = 0; i < 4 * n; ++i) {
+            size_t key = dist_i(gen);
+            a.insert(key + max_value + 1);
+            b.insert(key);
+            c.insert(key);
+            r.insert(key);
+        }
+        auto snapshot = c.snapshot();
+        a = std::move(b);
+        if(a.size() != r.size() || !std::equal(a.begin(), a.end(), r.begin()) || !b.empty() || a.get_allocator().resource() != &ra) {
+            std::cerr << RED("[pmr] err: move assignment across resources does not match\n");
+            std::abort();
+        }
+        a = std::move(c);
+        b = std::move(a);
+        b.insert(max_value + 1);
+        if(b.size() != r.size() + 1 || !a.empty() || snapshot.size() != r.size()) {
+            std::cerr << RED("[pmr] err: move assignment with a snapshot alive does not match\n");
+            std::abort();
+        }
+    }
+
+    // the map pools its nodes the same way
+    using pmr_map = ADS_map<size_t, size_t, 0, std::pmr::polymorphic_allocator<std::pair<const size_t, size_t>>>;
+    {
+        pmr_map a{ &ra }, b{ &rb };
+        std::map<size_t, size_t> r;
+        for(size_t i = 0; i < 4 * n; ++i) {
+            size_t key = dist_i(gen);
+            a[key + max_value + 1] = i;
+            b[key] = i;
+            r[key] = i;
+        }
+        a = std::move(b);
+        if(a.size() != r.size() || !b.empty() || a.get_allocator().resource() != &ra
+           || !std::equal(r.begin(), r.end(), a.begin(), [](auto const& l, auto const& r) { return l.first == r.first && l.second == r.second; })) {
+            std::cerr << RED("[pmr] err: map move assignment across resources does not match\n");
+            std::abort();
+        }
+        b = std::move(a);
+        b[max_value + 1] = 0;
+    }
+    if(ra.blocks() || rb.blocks()) {
+        std::cerr << RED("[pmr] err: " << ra.blocks() << " blocks of A and " << rb.blocks() << " of B were not given back\n");
+        std::abort();
+    }
+}
+
+template <class RNG>
+void test_comparators(size_t n, size_t max_value, RNG&& gen) {
+    std::cerr << "\n=== test_comparators ===\n";
+    std::uniform_int_distribution<size_t> dist_i{ 0, max_value };
+
+    // stateful comparator, the direction is chosen at run time
+    struct directed {
+        bool descending;
+        bool operator()(size_t lhs, size_t rhs) const { return descending ? rhs < lhs : lhs < rhs; }
+    };
+    ads::ordered_set<size_t, directed> a(directed{ true });
+    std::set<size_t, directed> r(directed{ true });
+    for(size_t i = 0; i < 2 * n; ++i) {
+        size_t key = dist_i(gen);
+        if(a.insert(key).second != r.insert(key).second) {
+            std::cerr << RED("[comparators] err: insert(" << key << ") disagrees\n");
+            std::abort();
+        }
+        if(i % 3 == 0) {
+            key = dist_i(gen);
+            if(a.erase(key) != r.erase(key)) {
+                std::cerr << RED("[comparators] err: erase(" << key << ") disagrees\n");
+                std::abort();
+            }
+        }
+    }
+    auto b = a;
+    b.insert({ max_value + 1, max_value + 2 });
+    if(!a.key_comp().descending || !b.key_comp().descending || !std::equal(a.begin(), a.end(), r.begin()) || *b.begin() != max_value + 2) {
+        std::cerr << RED("[comparators] err: descending set does not match\n");
+        std::abort();
+    }
+
+    // merging a set in the other order keeps both comparators where they were
+    for(size_t extra: { size_t(0), max_value + 10 }) {
+        ads::ordered_set<size_t, directed> c(directed{ true });
+        ads::ordered_set<size_t, directed> up(directed{ false });
+        if(extra == 0) {
+            c = a;
+        }
+        std::set<size_t, directed> expected = extra == 0 ? r : std::set<size_t, directed>(directed{ true });
+        std::set<size_t, directed> left(directed{ false });
+        for(size_t key: { extra + 1, extra + 2, extra + 3, *r.begin() }) {
+            up.insert(key);
+            if(!expected.insert(key).second) {
+                left.insert(key);
+            }
+        }
+        c.merge(up);
+        if(!c.key_comp().descending || up.key_comp().descending || c.size() != expected.size() || !std::equal(c.begin(), c.end(), expected.begin())
+           || up.size() != left.size() || !std::equal(up.begin(), up.end(), left.begin())) {
+            std::cerr << RED("[comparators] err: merge across directions does not match\n");
+            std::abort();
+        }
+    }
+
+    // the map keeps its comparator through copies and moves
+    ads::ordered_map<size_t, size_t, directed> m(directed{ true });
+    std::map<size_t, size_t, directed> rm(directed{ true });
+    for(size_t i = 0; i < 2 * n; ++i) {
+        size_t key = dist_i(gen);
+        if(m.try_emplace(key, i).second != rm.try_emplace(key, i).second) {
+            std::cerr << RED("[comparators] err: map insert(" << key << ") disagrees\n");
+            std::abort();
+        }
+        if(i % 3 == 0) {
+            key = dist_i(gen);
+            if(m.erase(key) != rm.erase(key)) {
+                std::cerr << RED("[comparators] err: map erase(" << key << ") disagrees\n");
+                std::abort();
+            }
+        }
+    }
+    auto moved = std::move(m);
+    ads::ordered_map<size_t, size_t, directed> copied(directed{ false });
+    copied = moved;
+    if(!moved.key_comp().descending || !copied.key_comp().descending || moved.size() != rm.size() || copied != moved
+       || !std::equal(rm.begin(), rm.end(), moved.begin(), [](auto const& l, auto const& r) { return l.first == r.first && l.second == r.second; })) {
+        std::cerr << RED("[comparators] err: descending map does not match\n");
+        std::abort();
+    }
+
+    // transparent comparator, C strings are looked up without building a key
+    ads::ordered_set<std::string, std::less<>> s;
+    std::set<std::string, std::less<>> t;
+    for(size_t i = 0; i < n; ++i) {
+        std::string key = std::to_string(dist_i(gen));
+        s.insert(key);
+        t.insert(key);
+    }
+    for(size_t i = 0; i <= max_value; ++i) {
+        std::string key = std::to_string(i);
+        char const* probe = key.c_str();
+        auto lb = s.lower_bound(probe);
+        auto rl = t.lower_bound(probe);
+        auto it = s.find(probe);
+        if(s.count(probe) != t.count(probe) || (it == s.end()) != (t.find(probe) == t.end()) ||
+           (lb == s.end()) != (rl == t.end()) || (rl != t.end() && *lb != *rl)) {
+            std::cerr << RED("[comparators] err: lookup of " << probe << " disagrees\n");
+            std::abort();
+        }
+    }
+}
+
+// sorted runs of every length up to a few blocks, drawn from the edge values
+// of T and some small ones so that runs repeat keys. every value is probed
+template <typename T, typename RNG>
+void check_search_kernel(char const* name, RNG&& gen) {
+    using limits = std::numeric_limits<T>;
+    using search = ADS_search<T, std::less<T>>;
+    std::vector<T> pool{ limits::lowest(), T(limits::lowest() + 1), T(0), T(1), T(limits::max() - 1), limits::max() };
+    if(limits::has_infinity) {
+        pool.push_back(limits::infinity());
+        pool.push_back(-limits::infinity());
+    }
+    std::uniform_int_distribution<int> dist_v{ -100, 100 };
+    for(size_t i = 0; i < 24; ++i) {
+        pool.push_back(T(dist_v(gen)));
+    }
+
+    std::uniform_int_distribution<size_t> pick{ 0, pool.size() - 1 };
+    for(unsigned n = 0; n <= 40; ++n) {
+        for(size_t round = 0; round < 8; ++round) {
+            std::vector<T> keys(n);
+            for(T& key: keys) {
+                key = pool[pick(gen)];
+            }
+            std::sort(keys.begin(), keys.end());
+            for(T key: pool) {
+                unsigned lower = unsigned(std::lower_bound(keys.begin(), keys.end(), key) - keys.begin());
+                unsigned upper = unsigned(std::upper_bound(keys.begin(), keys.end(), key) - keys.begin());
+                if(search::lower(keys.data(), n, key, std::less<T>()) != lower || search::upper(keys.data(), n, key, std::less<T>()) != upper) {
+                    std::cerr << RED("[search] err: " << name << " bounds of " << +key << " in " << n << " keys disagree\n");
+                    std::abort();
+                }
+            }
+        }
+    }
+}
+
+template <typename RNG>
+void test_search_kernels(RNG&& gen) {
+    std::cerr << "\n=== test_search_kernels ===\n";
+    static_assert(ads_simd::kind_of<int32_t>::value == ads_simd::int32 && ads_simd::kind_of<uint32_t>::value == ads_simd::uint32
+                  && ads_simd::kind_of<int64_t>::value == ads_simd::int64 && ads_simd::kind_of<uint64_t>::value == ads_simd::uint64
+                  && ads_simd::kind_of<float>::value == ads_simd::float32 && ads_simd::kind_of<double>::value == ads_simd::float64
+                  && ads_simd::kind_of<int16_t>::value == ads_simd::scalar, "unexpected kernel kinds");
+    check_search_kernel<int32_t>("int32", gen);
+    check_search_kernel<uint32_t>("uint32", gen);
+    check_search_kernel<int64_t>("int64", gen);
+    check_search_kernel<uint64_t>("uint64", gen);
+    check_search_kernel<float>("float32", gen);
+    check_search_kernel<double>("float64", gen);
+    check_search_kernel<int16_t>("scalar", gen);
+}
+
+template <class S>
+void check_fanout_geometry(char const* name) {
+    static_assert(sizeof(typename S::LeafNode) % 64 == 0, "leaf does not fill whole cache lines");
+    static_assert(sizeof(typename S::InternalNode) % 64 == 0, "internal node does not fill whole cache lines");
+    if(S::leaf_n < 2 || S::internal_n < 2 || sizeof(typename S::LeafNode) > ADS_LEAF_BYTES || sizeof(typename S::InternalNode) > ADS_INTERNAL_BYTES) {
+        std::cerr << RED("[fanout] err: " << name << " nodes do not fit their target size\n");
+        std::abort();
+    }
+}
+
+template <typename RNG>
+void test_fanout(size_t n, size_t max_value, RNG&& gen) {
+    std::cerr << "\n=== test_fanout ===\n";
+    std::uniform_int_distribution<size_t> dist_i{ 0, max_value };
+
+    check_fanout_geometry<ADS_set<int>>("int");
+    check_fanout_geometry<ADS_set<size_t>>("size_t");
+    check_fanout_geometry<ADS_set<std::string>>("string");
+    check_fanout_geometry<ADS_set<val_t>>("val_t");
+
+    // tiny leafs below wide internal nodes and the other way round
+    ADS_set<size_t, 0, std::allocator<size_t>, std::less<size_t>, 2, 7> a;
+    ADS_set<size_t, 0, std::allocator<size_t>, std::less<size_t>, 9, 2> b;
+    ADS_map<size_t, size_t, 0, std::allocator<std::pair<const size_t, size_t>>, std::less<size_t>, 2, 7> c;
+    ADS_concurrent_set<size_t, 0, 9, 2> d;
+    std::set<size_t> r;
+    for(size_t i = 0; i < 2 * n; ++i) {
+        size_t key = dist_i(gen);
+        bool inserted = r.insert(key).second;
+        if(a.insert(key).second != inserted || b.insert(key).second != inserted || c.try_emplace(key, key).second != inserted || d.insert(key) != inserted) {
+            std::cerr << RED("[fanout] err: insert(" << key << ") disagrees\n");
+            std::abort();
+        }
+        if(i % 3 == 0) {
+            key = dist_i(gen);
+            size_t erased = r.erase(key);
+            if(a.erase(key) != erased || b.erase(key) != erased || c.erase(key) != erased || d.erase(key) != erased) {
+                std::cerr << RED("[fanout] err: erase(" << key << ") disagrees\n");
+                std::abort();
+            }
+        }
+    }
+    if(a.size() != r.size() || b.size() != r.size() || c.size() != r.size() || d.size() != r.size()
+       || !std::equal(a.begin(), a.end(), r.begin()) || !std::equal(b.begin(), b.end(), r.begin())
+       || !std::equal(r.begin(), r.end(), c.begin(), [](size_t key, auto const& kv) { return kv.first == key && kv.second == key; })) {
+        std::cerr << RED("[fanout] err: sets with split fanouts do not match\n");
+        std::abort();
+    }
+    for(size_t i = 0; i < r.size(); i += 7) {
+        auto it = r.begin();
+        std::advance(it, i);
+        if(*a.select(i) != *it || *b.select(i) != *it || a.rank(*it) != i) {
+            std::cerr << RED("[fanout] err: select(" << i << ") disagrees\n");
+            std::abort();
+        }
+    }
+}
 #endif
 
 void test_initlist_constructor1() {
@@ -553,6 +1614,149 @@ void test_assign(ads::set<val_t> const& a, std::set<val_t> const& r) {
     }
 }
 
+void test_move(ads::set<val_t>& a, std::set<val_t> const& r) {
+    std::cerr << "\n=== test_move ===\n";
+
+    ads::set<val_t> b{ std::move(a) };
+    if(b != r || !a.empty() || a.begin() != a.end()) {
+        std::cerr << RED("[move] err: move construction did not take all values\n");
+        dump_compare(b, r);
+        std::abort();
+    }
+    a.insert(val_t(1));
+    a = std::move(b);
+    if(a != r) {
+        std::cerr << RED("[move] err: move assignment did not take all values\n");
+        dump_compare(a, r);
+        std::abort();
+    }
+
+    // moving allocates nothing, containers of sets move them when they grow
+    static_assert(std::is_nothrow_move_constructible<ads::set<val_t>>::value, "set move construction may throw");
+    static_assert(std::is_nothrow_move_assignable<ads::set<val_t>>::value, "set move assignment may throw");
+    ads::set<val_t> copy_of_moved{ b };
+    if(!b.empty() || b.count(val_t(1)) || b.lower_bound(val_t(1)) != b.end() || b.rank(val_t(1)) != 0 || !copy_of_moved.empty()) {
+        std::cerr << RED("[move] err: moved-from set is not empty\n");
+        std::abort();
+    }
+    b.insert(val_t(1));
+    if(b.size() != 1 || !b.count(val_t(1))) {
+        std::cerr << RED("[move] err: moved-from set cannot be written again\n");
+        std::abort();
+    }
+    std::vector<ads::set<val_t>> sets(1);
+    sets[0] = std::move(a);
+    auto const* first_key = sets[0].empty() ? nullptr : &*sets[0].begin();
+    sets.resize(sets.capacity() + 1);
+    if(sets[0] != r || (first_key && first_key != &*sets[0].begin())) {
+        std::cerr << RED("[move] err: growing a vector of sets copied them\n");
+        std::abort();
+    }
+    a = std::move(sets[0]);
+
+    ads::set<val_t> c;
+    for(auto const& v: r) {
+        val_t moved{ v };
+        auto p = (v.i % 2) ? c.insert(std::move(moved)) : c.emplace(v.i);
+        if(!p.second || p.first == c.end() || p.first->i != v.i) {
+            std::cerr << RED("[move] err: insert of an rvalue or emplace of " << v << " returned " << it2str(c, p.first) << '\n');
+            std::abort();
+        }
+    }
+    if(c != r || (!r.empty() && c.emplace(r.begin()->i).second)) {
+        std::cerr << RED("[move] err: set built by rvalue inserts and emplace does not match\n");
+        dump_compare(c, r);
+        std::abort();
+    }
+}
+
+void test_extract_merge(ads::set<val_t> const& a, std::set<val_t> const& r) {
+    std::cerr << "\n=== test_extract_merge ===\n";
+
+    ads::set<val_t> c{ a };
+    size_t k = 0;
+    for(auto const& v: r) {
+        if(k++ % 3) continue;
+        auto node = c.extract(v);
+        if(node.empty() || node.value().i != v.i || c.count(v) || c.extract(v)) {
+            std::cerr << RED("[extract_merge] err: extract(" << v << ") did not take the value out\n");
+            std::abort();
+        }
+        auto back = c.insert(std::move(node));
+        if(!back.inserted || !back.node.empty() || back.position == c.end() || back.position->i != v.i) {
+            std::cerr << RED("[extract_merge] err: insert of the node holding " << v << " returned " << it2str(c, back.position) << '\n');
+            std::abort();
+        }
+    }
+    if(c != r) {
+        std::cerr << RED("[extract_merge] err: set after extract and insert does not match\n");
+        dump_compare(c, r);
+        std::abort();
+    }
+    if(!r.empty()) {
+        ads::set<val_t> d{ *r.begin() };
+        auto again = c.insert(d.extract(d.begin()));
+        if(again.inserted || again.node.empty() || again.node.value().i != r.begin()->i || again.position != c.begin()) {
+            std::cerr << RED("[extract_merge] err: insert of a node holding a present value\n");
+            std::abort();
+        }
+    }
+
+    // overlapping ranges: every third value is in both sets
+    ads::set<val_t> x, y;
+    k = 0;
+    for(auto const& v: r) {
+        if(k % 2 == 0 || k % 3 == 0) x.insert(v);
+        if(k % 2 == 1 || k % 3 == 0) y.insert(v);
+        ++k;
+    }
+    x.merge(y);
+    k = 0;
+    for(auto const& v: r) {
+        if(k++ % 3 == 0 && !y.count(v)) {
+            std::cerr << RED("[extract_merge] err: merge took " << v << " which was present in both\n");
+            std::abort();
+        }
+    }
+    if(x != r || y.size() != (r.size() + 2) / 3) {
+        std::cerr << RED("[extract_merge] err: merge of overlapping sets\n");
+        dump_compare(x, r);
+        std::abort();
+    }
+
+    // disjoint ranges, both ways round and with very different sizes
+    for(size_t cut: { r.size() / 2, r.size() / 50, r.size() - r.size() / 50 }) {
+        for(int way = 0; way < 2; ++way) {
+            ads::set<val_t> lo, hi;
+            auto mid = r.begin();
+            std::advance(mid, cut);
+            lo.insert(r.begin(), mid);
+            hi.insert(mid, r.end());
+            ads::set<val_t>& into = way ? hi : lo;
+            ads::set<val_t>& from = way ? lo : hi;
+            into.merge(from);
+            if(into != r || !from.empty()) {
+                std::cerr << RED("[extract_merge] err: merge of disjoint sets cut at " << cut << '\n');
+                dump_compare(into, r);
+                std::abort();
+            }
+            k = 0;
+            for(auto it_r = r.begin(); it_r != r.end(); ++it_r, ++k) {
+                if(into.rank(*it_r) != k) {
+                    std::cerr << RED("[extract_merge] err: rank(" << *it_r << ") after a merge is " << into.rank(*it_r) << ", expected " << k << '\n');
+                    std::abort();
+                }
+            }
+            from.insert(val_t(1));
+            for(auto const& v: r) into.erase(v);
+            if(!into.empty() || from.size() != 1) {
+                std::cerr << RED("[extract_merge] err: sets are not usable after a merge\n");
+                std::abort();
+            }
+        }
+    }
+}
+
 void test_assign_initlist(ads::set<val_t>& a, std::set<val_t>& r) {
     std::cerr << "\n=== test_assign_initlist ===\n";
 
@@ -607,6 +1811,36 @@ void test_iter(ads::set<val_t> const& a, std::set<val_t> const& r) {
         std::abort();
     }
 }
+
+void test_reverse_iter(ads::set<val_t> const& a, std::set<val_t> const& r) {
+    std::cerr << "\n=== test_reverse_iter ===\n";
+
+    size_t dist = std::distance(a.rbegin(), a.rend());
+    if(dist != r.size()) {
+        std::cerr << RED("[reverse_iter] err: range size (distance between rbegin and rend) is wrong.\n"
+                  << "expected: " << r.size() << ", but got: " << dist << '\n');
+        dump_compare(a, r);
+        std::abort();
+    }
+
+    auto it_r = r.rbegin();
+    for(auto it_a = a.rbegin(); it_a != a.rend(); ++it_a, ++it_r) {
+        if(it_a->i != it_r->i) {
+            std::cerr << RED("[reverse_iter] err: encountered " << *it_a << " while iterating backwards, but expected " << *it_r << '\n');
+            dump_compare(a, r);
+            std::abort();
+        }
+    }
+
+    // forwards and back again has to end up where we started
+    auto it = a.end();
+    for(size_t i = 0; i < r.size(); ++i) { --it; }
+    if(it != a.begin()) {
+        std::cerr << RED("[reverse_iter] err: decrementing end() size() times does not reach begin()\n");
+        dump_compare(a, r);
+        std::abort();
+    }
+}
 #endif
 
 #ifndef PH2
@@ -651,6 +1885,15 @@ template <class RNG>
 void test_all_ph2(size_t n, size_t max_value, RNG&& gen) {
     test_initlist_constructor3(n, max_value, gen);
     test_range_constructor3(n, max_value, gen);
+    test_sharded(n, max_value, gen);
+    test_paged(n, max_value, gen);
+    test_logged(n, max_value, gen);
+    test_string_keys(n, max_value, gen);
+    test_map(n, max_value, gen);
+    test_comparators(n, max_value, gen);
+    test_search_kernels(gen);
+    test_fanout(n, max_value, gen);
+    test_pmr_move(n, max_value, gen);
 
     {
         ads::set<val_t> a;
@@ -664,6 +1907,7 @@ void test_all_ph2(size_t n, size_t max_value, RNG&& gen) {
 
         test_insert(a, r, n, max_value, gen);
         test_iter(a, r);
+        test_reverse_iter(a, r);
 
         test_clear(a, r);
 
@@ -678,6 +1922,16 @@ void test_all_ph2(size_t n, size_t max_value, RNG&& gen) {
         test_insert_it(a, r, n, max_value, gen);
         test_count(a, r, max_value);
         test_find(a, r, max_value);
+        test_find_many(a, r, max_value);
+        test_bounds(a, r, max_value);
+        test_rank(a, r, max_value);
+        test_move(a, r);
+        test_extract_merge(a, r);
+        test_snapshot(a, r, n, max_value, gen);
+        test_algebra(a, r, max_value, gen);
+        test_save_load(a, r);
+        test_mapped(a, r, max_value);
+        test_frozen(a, r, max_value);
 
         test_size(a, r);
         test_clear(a, r);
@@ -693,7 +1947,11 @@ void test_all_ph2(size_t n, size_t max_value, RNG&& gen) {
         test_insert_erase(a, r, n, max_value, gen);
         test_count(a, r, max_value);
         test_find(a, r, max_value);
+        test_find_many(a, r, max_value);
+        test_bounds(a, r, max_value);
+        test_rank(a, r, max_value);
         test_iter(a, r);
+        test_reverse_iter(a, r);
 
         test_size(a, r);
         test_empty(a, r);
@@ -758,6 +2016,26 @@ void do_stresstest1() {
         elapsed_count = std::chrono::duration<double, std::milli>(end - start).count();
     }
 
+    double elapsed_count_many;
+    {
+        std::vector<bool> found;
+        auto start = std::chrono::high_resolution_clock::now();
+        size_t hits = a.count_many(vs.data(), n, found);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        if(hits != n) {
+            for(size_t i = 0; i < n; ++i) {
+                if(!found[i]) {
+                    std::cerr << RED("[stresstest1] err: count_many missed value " << i << '\n');
+                    break;
+                }
+            }
+            std::abort();
+        }
+
+        elapsed_count_many = std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
 
     if(a.size() != n) {
         std::cerr << RED("[stresstest1] err: wrong size, expected " << n << " but is " << a.size()) << '\n';
@@ -766,7 +2044,8 @@ void do_stresstest1() {
 
 
     std::cerr << "elapsed_insert = " << elapsed_insert << " ms\n"
-              << "elapsed_count  = " << elapsed_count  << " ms\n";
+              << "elapsed_count  = " << elapsed_count  << " ms\n"
+              << "elapsed_count_many = " << elapsed_count_many << " ms\n";
 }
 
 #ifdef PH2
@@ -834,6 +2113,81 @@ void do_stresstest2() {
 }
 #endif
 
+#ifdef PH2
+/* the same work split over more and more threads, every thread has its own block of keys */
+void do_stresstest3() {
+    std::cerr << "\n=== stresstest3 ===\n";
+
+    size_t const n = 1000000;
+    size_t const cores = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+    for(size_t threads = 1;; threads = std::min(2 * threads, cores)) {
+        ADS_concurrent_set<size_t> a;
+        std::atomic<bool> failed{ false };
+
+        auto run = [&](std::function<void(size_t, size_t)> work) {
+            std::vector<std::thread> pool;
+            auto start = std::chrono::high_resolution_clock::now();
+            for(size_t t = 0; t < threads; ++t) {
+                pool.emplace_back(work, t * n / threads, (t + 1) * n / threads);
+            }
+            for(auto& th : pool) { th.join(); }
+            auto end = std::chrono::high_resolution_clock::now();
+
+            if(failed) { std::abort(); }
+            return std::chrono::duration<double, std::milli>(end - start).count();
+        };
+
+        double elapsed_insert = run([&](size_t first, size_t last) {
+            for(size_t i = first; i < last; ++i) {
+                if(!a.insert(i)) {
+                    std::cerr << RED("[stresstest3] err: returned wrong insertion status (false) for value " << i << '\n');
+                    failed = true;
+                    return;
+                }
+            }
+        });
+
+        double elapsed_count = run([&](size_t first, size_t last) {
+            for(size_t i = first; i < last; ++i) {
+                if(!a.count(i)) {
+                    std::cerr << RED("[stresstest3] err: missing value " << i << '\n');
+                    failed = true;
+                    return;
+                }
+            }
+        });
+
+        double elapsed_erase = run([&](size_t first, size_t last) {
+            for(size_t i = first; i < last; ++i) {
+                if(i % 2 == 0 && !a.erase(i)) {
+                    std::cerr << RED("[stresstest3] err: couldn't erase element " << i << '\n');
+                    failed = true;
+                    return;
+                }
+                if(i % 2 == 1 && !a.count(i)) {
+                    std::cerr << RED("[stresstest3] err: lost value " << i << " while erasing its neighbours\n");
+                    failed = true;
+                    return;
+                }
+            }
+        });
+
+        if(a.size() != n / 2) {
+            std::cerr << RED("[stresstest3] err: wrong size, expected " << n / 2 << " but is " << a.size()) << '\n';
+            std::abort();
+        }
+
+        std::cerr << "threads = " << threads << '\n'
+                  << "elapsed_insert = " << elapsed_insert << " ms\n"
+                  << "elapsed_count  = " << elapsed_count  << " ms\n"
+                  << "elapsed_erase  = " << elapsed_erase  << " ms\n";
+
+        if(threads == cores) { break; }
+    }
+}
+#endif
+
 /* zeit möglicherweise zu knapp bemessen für container mit pervers
  * kleinem default N. (-D SIZE) */
 void stresstest() {
@@ -851,6 +2205,13 @@ void stresstest() {
         std::cerr << YELLOW("[stresstest2] timeout: exceeded 2s timeframe.\n");
         std::abort();
     }
+
+    auto h = std::async(std::launch::async, do_stresstest3);
+
+    if(h.wait_for(std::chrono::seconds(5)) == std::future_status::timeout) {
+        std::cerr << YELLOW("[stresstest3] timeout: exceeded 5s timeframe.\n");
+        std::abort();
+    }
 #endif
 }
 